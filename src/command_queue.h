@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace gl {
+
+	/*
+	 * A 32 bit word threads can sleep on until it changes (futex on Linux and Android).
+	 * Other platforms fall back to yielding and short sleeps.
+	 */
+	class wake_word {
+		std::atomic<uint32_t> v;
+
+	public:
+		wake_word(uint32_t init = 0) : v(init) {}
+
+		inline uint32_t load() const { return v.load(); }
+
+		inline void store(uint32_t x) { v.store(x); }
+
+		inline uint32_t increment() { return v.fetch_add(1) + 1; }
+
+		/*
+		 * Sleeps while the word equals expected. Returns false on timeout, might return spuriously.
+		 */
+		bool wait(uint32_t expected, std::chrono::nanoseconds timeout) {
+			if (v.load() != expected)
+				return true;
+#if defined(__linux__)
+			struct timespec ts{(time_t) (timeout.count() / 1000000000),
+							   (long) (timeout.count() % 1000000000)};
+			if (syscall(SYS_futex, reinterpret_cast<uint32_t *>(&v), FUTEX_WAIT_PRIVATE, expected,
+						&ts, nullptr, 0) == -1)
+				return errno != ETIMEDOUT;
+			return true;
+#else
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; v.load() == expected; ++i) {
+				if (std::chrono::steady_clock::now() - t0 > timeout)
+					return false;
+				if (i < 64) std::this_thread::yield();
+				else std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+			return true;
+#endif
+		}
+
+		void wakeAll() {
+#if defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&v), FUTEX_WAKE_PRIVATE, INT_MAX,
+					nullptr, nullptr, 0);
+#endif
+		}
+	};
+
+	/*
+	 * Bounded lock-free queue for many producers and a single consumer (a ring of sequenced cells,
+	 * after D. Vyukov). pop() puts the consumer to sleep on a wake_word if the queue is empty,
+	 * producers only issue the wake-up syscall if it is actually sleeping.
+	 */
+	template<typename E>
+	class command_queue {
+		struct cell {
+			std::atomic<size_t> seq;
+			E e;
+		};
+
+		// head, tail and signal are a cache line apart. Padded rather than alignas(64), so the
+		// renderers holding a queue stay plainly aligned for new (C++14)
+		enum : size_t { cache_line = 64 };
+
+		std::vector<cell> ring;
+		size_t mask;
+		char pad0[cache_line];
+		std::atomic<size_t> head; // producers
+		char pad1[cache_line - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> tail; // consumer
+		char pad2[cache_line - sizeof(std::atomic<size_t>)];
+		wake_word signal;
+		std::atomic<bool> sleeping;
+		char pad3[cache_line - sizeof(wake_word) - sizeof(std::atomic<bool>)];
+
+	public:
+		explicit command_queue(size_t capacity = 64)
+				: ring(capacity), mask(capacity - 1), head(0), tail(0), sleeping(false) {
+			if (capacity < 2 || (capacity & mask) != 0)
+				throw std::invalid_argument("command_queue: capacity must be a power of 2");
+			for (size_t i = 0; i < capacity; ++i)
+				ring[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		command_queue(const command_queue &) = delete;
+
+		bool tryPush(E &&e) {
+			size_t pos = head.load(std::memory_order_relaxed);
+			cell *c;
+			while (true) {
+				c = &ring[pos & mask];
+				size_t seq = c->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+				if (diff == 0) {
+					if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				} else if (diff < 0) {
+					return false; // full
+				} else {
+					pos = head.load(std::memory_order_relaxed);
+				}
+			}
+			c->e = std::move(e);
+			c->seq.store(pos + 1, std::memory_order_release);
+
+			signal.increment();
+			if (sleeping.load())
+				signal.wakeAll();
+			return true;
+		}
+
+		// blocks (yielding) while the queue is full
+		void push(E &&e) {
+			while (!tryPush(std::move(e)))
+				std::this_thread::yield();
+		}
+
+		bool tryPop(E &e) {
+			size_t pos = tail.load(std::memory_order_relaxed);
+			cell &c(ring[pos & mask]);
+			if ((intptr_t) c.seq.load(std::memory_order_acquire) - (intptr_t) (pos + 1) < 0)
+				return false; // empty
+			e = std::move(c.e);
+			c.e = E();
+			c.seq.store(pos + mask + 1, std::memory_order_release);
+			tail.store(pos + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		/*
+		 * Pops the next element, sleeping up to timeout for one to arrive. Consumer thread only.
+		 */
+		bool pop(E &e, std::chrono::nanoseconds timeout) {
+			if (tryPop(e))
+				return true;
+			if (timeout.count() <= 0)
+				return false;
+
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			while (true) {
+				uint32_t s = signal.load();
+				sleeping.store(true);
+				bool got = tryPop(e);
+				if (!got) {
+					auto left = deadline - std::chrono::steady_clock::now();
+					if (left.count() > 0)
+						signal.wait(s, left);
+					got = tryPop(e);
+				}
+				sleeping.store(false);
+				if (got)
+					return true;
+				if (std::chrono::steady_clock::now() >= deadline)
+					return false;
+			}
+		}
+	};
+}
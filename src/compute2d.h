@@ -0,0 +1,107 @@
+#pragma once
+
+#include <GLES3/gl31.h>
+
+#include "renderer2d.h"
+
+namespace gl {
+
+	/*
+	 * A renderer2d running an OpenGL ES 3.1 compute shader instead of a fragment shader, with the same
+	 * inputs, output, commands and threading.
+	 *
+	 * The output is bound to image unit 0 (e.g. `layout(rgba16ui, binding = 0) writeonly uniform
+	 * highp uimage2D u_out`). Inputs are bound as samplers like with renderer2d and, if their format
+	 * allows image access, also to read-only image unit i + 1 for the i-th input. The work group size
+	 * (default 16x16) is available as LOCAL_SIZE_X and LOCAL_SIZE_Y next to WIDTH and HEIGHT, the
+	 * dispatch covers the frame with whole groups, so shaders must skip invocations outside of it.
+	 */
+	template<typename T, int C>
+	class compute2d : public renderer2d<T, C> {
+		// ES 3.1 image load/store has RGBA formats of all texel types, single channels only of 32 bit
+		static_assert(C == 4 || (C == 1 && (std::is_same<T, float>::value || std::is_same<T, uint32_t>::value ||
+											 std::is_same<T, int32_t>::value)),
+					  "compute2d: the output is no ES 3.1 image format, use 4 components or 1 of 32 bit");
+
+		int groupX = 16, groupY = 16;
+
+	public:
+		compute2d(int width, int height, const std::string &computeShaderSrc, context &gl)
+				: renderer2d<T, C>(width, height, computeShaderSrc, gl) {}
+
+		~compute2d() {
+			this->stop(); // before the overrides are gone
+		}
+
+		void setWorkGroupSize(int x, int y) {
+			if (this->isAlive())
+				throw std::logic_error("compute2d: renderer already alive");
+			if (x < 1 || y < 1)
+				throw std::invalid_argument("compute2d: invalid work group size");
+			groupX = x, groupY = y;
+		}
+
+		inline int workGroupsX() const { return (this->target.texBuf.width + groupX - 1) / groupX; }
+
+		inline int workGroupsY() const { return (this->target.texBuf.height + groupY - 1) / groupY; }
+
+		// the program a compute2d of w x h builds for a compute shader source, for program_cache::warmUp()
+		static std::vector<shader_stage> programStages(const std::string &src, int w, int h, int x = 16, int y = 16) {
+			glsl_processor processor(sizeMacros(w, h));
+			processor.d("LOCAL_SIZE_X", x), processor.d("LOCAL_SIZE_Y", y);
+			return {{GL_COMPUTE_SHADER, processor.process(src)}};
+		}
+
+	protected:
+		GLuint linkProgram(glsl_processor &processor, const std::string &src) override {
+			processor.d("LOCAL_SIZE_X", groupX), processor.d("LOCAL_SIZE_Y", groupY);
+			return program_cache::get().build(this->gl, {{GL_COMPUTE_SHADER, processor.process(src)}});
+		}
+
+		void drawFrame(render_target<T, C> &target, const rect &roi) override {
+			if (!roi.empty())
+				throw std::logic_error("compute2d: region of interest rendering is not supported");
+			if (this->accumulate)
+				throw std::logic_error("compute2d: accumulation is not supported");
+
+			auto &state(state_cache::get());
+			texture_base &out(target.texBuf);
+			GLuint unit = 0;
+			glBindImageTexture(unit++, out.getGlId(), 0, GL_FALSE, 0, GL_WRITE_ONLY, out.getGlSizedFormat());
+			for (auto &tb : this->inputBindings) {
+				if (tb.uLoc == -1) {
+					// not sampled, so renderer2d did not bind it: upload pending data on a spare unit
+					int spare = (int) this->inputBindings.size();
+					state.bindTexture(spare, tb.tex.getGlTarget(), tb.tex.getGlId());
+					state.activeTexture(spare);
+					tb.tex._preRender();
+				}
+				GLenum fmt = tb.tex.getGlSizedFormat();
+				if (tb.tex.getGlTarget() == GL_TEXTURE_2D && imageFormat(fmt))
+					glBindImageTexture(unit, tb.tex.getGlId(), 0, GL_FALSE, 0, GL_READ_ONLY, fmt);
+				++unit;
+			}
+			this->gl.checkAndThrowError("compute2d: glBindImageTexture");
+
+			glDispatchCompute(workGroupsX(), workGroupsY(), 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT |
+							GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT |
+							GL_TEXTURE_UPDATE_BARRIER_BIT);
+			state.count(3);
+		}
+
+	private:
+		// formats usable with image load/store in ES 3.1
+		static bool imageFormat(GLenum fmt) {
+			switch (fmt) {
+				case GL_RGBA32F: case GL_RGBA16F: case GL_R32F:
+				case GL_RGBA32UI: case GL_RGBA16UI: case GL_RGBA8UI: case GL_R32UI:
+				case GL_RGBA32I: case GL_RGBA16I: case GL_RGBA8I: case GL_R32I:
+				case GL_RGBA8: case GL_RGBA8_SNORM:
+					return true;
+				default:
+					return false;
+			}
+		}
+	};
+}
@@ -2,9 +2,11 @@
 
 #include <thread>
 #include <condition_variable>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <functional>
+#include <type_traits>
 
 #define DESKTOP_USE_EGL
 
@@ -33,6 +35,7 @@
 #endif
 
 #include "Stopwatch.h"
+#include "half.h"
 
 namespace egl {
 	void *create_window();
@@ -57,9 +60,12 @@ namespace gl {
 		constexpr glSymbol(GLint value, char const (&name)[N]) :value(value), name(name) {}
 	};
 
-	struct float16_t {
-		uint16_t h;
-	};
+	// texel types sampled as floats (sampler2D rather than isampler2D/usampler2D)
+	template<typename T>
+	struct is_float_texel : std::is_floating_point<T> {};
+
+	template<>
+	struct is_float_texel<float16_t> : std::true_type {};
 
 	struct buf_use {
 		bool cpuRead, cpuWrite, gpuRead, gpuWrite;
@@ -81,13 +87,24 @@ namespace gl {
 		}
 	};
 
+	// pixel rectangle, origin at the bottom-left as in GL window coordinates
+	struct rect {
+		int x, y, width, height;
+
+		inline bool empty() const { return width <= 0 || height <= 0; }
+
+		inline bool inside(int w, int h) const {
+			return x >= 0 && y >= 0 && x + width <= w && y + height <= h;
+		}
+	};
+
 
 
 #define GL_SYM(NAME) glSymbol{ GL_ ## NAME, #NAME }
 #define GL_SYM_SFMTS(T) {GL_SYM(R ## T), GL_SYM(RG ## T), GL_SYM(RGB ## T), GL_SYM(RGBA ## T)}
 
 	static constexpr glSymbol
-			sfmts_f32[] = GL_SYM_SFMTS(32F),
+			sfmts_f32[] = GL_SYM_SFMTS(32F), sfmts_f16[] = GL_SYM_SFMTS(16F),
 			sfmts_u32[] = GL_SYM_SFMTS(32UI), sfmts_i32[] = GL_SYM_SFMTS(32I),
 			sfmts_u16[] = GL_SYM_SFMTS(16UI), sfmts_i16[] = GL_SYM_SFMTS(16I),
 			sfmts_u8[] = GL_SYM_SFMTS(8UI), sfmts_i8[] = GL_SYM_SFMTS(8I);
@@ -351,12 +368,16 @@ namespace gl {
 			return LoadShader(type, shaderSrc.c_str());
 		}
 
-		GLuint Link(std::vector<GLuint> shaders) {
+		// retrievable: hint that glGetProgramBinary() will be used (see program_cache)
+		GLuint Link(std::vector<GLuint> shaders, bool retrievable = false) {
 			auto programObject = glCreateProgram();
 
 			for (auto sh : shaders)
 				glAttachShader(programObject, sh);
 
+			if (retrievable)
+				glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 			glLinkProgram(programObject);
 			checkAndReportError("gl::Link(): glLinkProgram");
 
@@ -417,6 +438,11 @@ namespace gl {
 	}
 
 
+	/*
+	 * Defines macros for shader sources as #define lines after the #version directive, so sources
+	 * stay intact and equal sources with equal macros give equal programs (see program_cache).
+	 * Names starting with $ are not valid GLSL identifiers and are still replaced in the text.
+	 */
 	class glsl_processor {
 		typedef std::string string;
 		std::vector<std::pair<string, string>> macros;
@@ -433,18 +459,44 @@ namespace gl {
 		}
 
 		string process(string src) {
+			string defines;
 			for (auto &p : macros) {
 				auto &s(p.first), t(p.second);
+				if (s[0] != '$') {
+					defines += "#define " + s + " " + t + "\n";
+					continue;
+				}
 				std::string::size_type n = 0;
 				while ((n = src.find(s, n)) != std::string::npos) {
 					src.replace(n, s.size(), t);
 					n += t.size();
 				}
 			}
+
+			if (!defines.empty()) {
+				// after the #version line, keeping line numbers in compiler messages
+				std::string::size_type pos = 0;
+				auto v = src.find("#version");
+				if (v != std::string::npos) {
+					pos = src.find('\n', v);
+					if (pos == std::string::npos) src += '\n', pos = src.size();
+					else ++pos;
+				}
+				int line = (int) std::count(src.begin(), src.begin() + pos, '\n') + 1;
+				src.insert(pos, defines + "#line " + std::to_string(line) + "\n");
+			}
 			LOG_D << src;
 			return src;
 		}
 	};
+
+	// the frame size macros of renderers and pipelines: $width/$height and WIDTH/HEIGHT
+	inline glsl_processor sizeMacros(int w, int h) {
+		glsl_processor processor;
+		processor.d("$width", w), processor.d("$height", h);
+		processor.d("WIDTH", w), processor.d("HEIGHT", h);
+		return processor;
+	}
 }
 
 namespace egl {
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace gl {
+
+	/*
+	 * A counter behind a pollable file descriptor (eventfd on Linux and Android), so event loops
+	 * (epoll, poll, select) can wait for completions next to their other fds. The fd is readable while
+	 * the counter is non-zero, drain() reads and resets it without blocking.
+	 */
+	class event_fd {
+		int fd = -1;
+
+	public:
+		event_fd() {
+#if defined(__linux__)
+			fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (fd == -1)
+				throw std::runtime_error(std::string("event_fd: eventfd() failed: ") + strerror(errno));
+#else
+			throw std::runtime_error("event_fd: eventfd not available on this platform");
+#endif
+		}
+
+		event_fd(const event_fd &) = delete;
+
+		~event_fd() {
+#if defined(__linux__)
+			if (fd != -1) close(fd);
+#endif
+		}
+
+		inline int get() const { return fd; }
+
+		void notify(uint64_t n = 1) {
+#if defined(__linux__)
+			while (write(fd, &n, sizeof(n)) == -1 && errno == EINTR);
+#endif
+		}
+
+		// returns the count since the last drain, 0 if there was none
+		uint64_t drain() {
+			uint64_t n = 0;
+#if defined(__linux__)
+			while (read(fd, &n, sizeof(n)) == -1) {
+				if (errno != EINTR)
+					return 0; // EAGAIN: nothing to drain
+			}
+#endif
+			return n;
+		}
+	};
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "context.h"
+
+namespace gl {
+
+	/*
+	 * Wraps a GL sync object to track completion of the commands issued before insert().
+	 * Must be inserted, waited and reset on the thread owning the GL context.
+	 */
+	class fence {
+		GLsync sync = 0;
+
+	public:
+		fence() = default;
+
+		// a sync object has a single owner
+		fence(const fence &) = delete;
+
+		fence &operator=(const fence &) = delete;
+
+		fence(fence &&o) noexcept : sync(o.sync) { o.sync = 0; }
+
+		fence &operator=(fence &&o) noexcept {
+			if (this != &o) {
+				reset();
+				sync = o.sync, o.sync = 0;
+			}
+			return *this;
+		}
+
+		void insert() {
+			reset();
+			sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			gl::context::checkAndThrowError("fence::insert(): glFenceSync");
+		}
+
+		inline bool pending() const { return sync != 0; }
+
+		/*
+		 * Returns true if the fence signaled within timeout (or was never inserted).
+		 * A signaled fence is released and becomes non-pending.
+		 */
+		bool wait(uint64_t timeoutNs) {
+			if (!sync)
+				return true;
+
+			auto r = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs);
+			if (r == GL_WAIT_FAILED) {
+				gl::context::checkAndThrowError("fence::wait(): glClientWaitSync");
+				throw std::runtime_error("fence::wait(): glClientWaitSync failed");
+			}
+			if (r == GL_TIMEOUT_EXPIRED)
+				return false;
+
+			reset();
+			return true;
+		}
+
+		inline bool poll() { return wait(0); }
+
+		void reset() {
+			if (sync) glDeleteSync(sync), sync = 0;
+		}
+	};
+}
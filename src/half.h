@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define GL_HALF_F16C
+#elif defined(__ARM_NEON) && (defined(__aarch64__) || (defined(__ARM_FP) && (__ARM_FP & 2)))
+#include <arm_neon.h>
+#define GL_HALF_NEON
+#endif
+
+namespace gl {
+	struct float16_t {
+		uint16_t h;
+	};
+
+	/*
+	 * Conversion between float and IEEE half floats (float16_t), rounding to nearest even. The array
+	 * versions use F16C on x86 (picked at runtime unless built with -mf16c) or NEON, with the
+	 * scalar code for the remainder and other targets.
+	 */
+	namespace half {
+		// see https://gist.github.com/rygorous/2156668
+		inline float16_t fromFloat(float f) {
+			uint32_t u;
+			memcpy(&u, &f, 4);
+			uint32_t sign = u & 0x80000000u;
+			u ^= sign;
+
+			uint32_t h;
+			if (u >= (127 + 16) << 23) { // Inf or NaN (quieted)
+				h = u > 0x7f800000u ? 0x7e00 : 0x7c00;
+			} else if (u < 113 << 23) { // subnormal or zero, let the FPU round the shifted mantissa
+				const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+				float magic, v;
+				memcpy(&magic, &magicBits, 4), memcpy(&v, &u, 4);
+				v += magic;
+				memcpy(&u, &v, 4);
+				h = u - magicBits;
+			} else {
+				uint32_t mantOdd = (u >> 13) & 1;
+				u += ((uint32_t) (15 - 127) << 23) + 0xfff + mantOdd;
+				h = u >> 13;
+			}
+			return float16_t{(uint16_t) (h | (sign >> 16))};
+		}
+
+		inline float toFloat(float16_t v) {
+			const uint32_t shiftedExp = 0x7c00u << 13;
+			uint32_t u = (uint32_t) (v.h & 0x7fff) << 13;
+			uint32_t exp = u & shiftedExp;
+			u += (127 - 15) << 23;
+			float f;
+			if (exp == shiftedExp) { // Inf or NaN
+				u += (128 - 16) << 23;
+				memcpy(&f, &u, 4);
+			} else if (exp == 0) { // subnormal or zero, renormalize
+				const uint32_t magicBits = 113 << 23;
+				float magic;
+				u += 1 << 23;
+				memcpy(&f, &u, 4), memcpy(&magic, &magicBits, 4);
+				f -= magic;
+			} else {
+				memcpy(&f, &u, 4);
+			}
+			memcpy(&u, &f, 4);
+			u |= (uint32_t) (v.h & 0x8000) << 16;
+			memcpy(&f, &u, 4);
+			return f;
+		}
+
+#if defined(GL_HALF_F16C)
+		namespace detail {
+			// compiled for F16C whatever the build flags, only called if the CPU has it
+			__attribute__((target("avx,f16c")))
+			inline size_t fromFloatF16C(const float *src, float16_t *dst, size_t n) {
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8)
+					_mm_storeu_si128((__m128i *) (dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+				return i;
+			}
+
+			__attribute__((target("avx,f16c")))
+			inline size_t toFloatF16C(const float16_t *src, float *dst, size_t n) {
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8)
+					_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (src + i))));
+				return i;
+			}
+
+			inline bool hasF16C() {
+#if defined(__F16C__)
+				return true;
+#else
+				static const bool has = (__builtin_cpu_init(), __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"));
+				return has;
+#endif
+			}
+		}
+#endif
+
+		inline void fromFloat(const float *src, float16_t *dst, size_t n) {
+			size_t i = 0;
+#if defined(GL_HALF_F16C)
+			if (detail::hasF16C())
+				i = detail::fromFloatF16C(src, dst, n);
+#elif defined(GL_HALF_NEON)
+			for (; i + 4 <= n; i += 4)
+				vst1_u16((uint16_t *) (dst + i), vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+#endif
+			for (; i < n; i++)
+				dst[i] = fromFloat(src[i]);
+		}
+
+		inline void toFloat(const float16_t *src, float *dst, size_t n) {
+			size_t i = 0;
+#if defined(GL_HALF_F16C)
+			if (detail::hasF16C())
+				i = detail::toFloatF16C(src, dst, n);
+#elif defined(GL_HALF_NEON)
+			for (; i + 4 <= n; i += 4)
+				vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16((const uint16_t *) (src + i)))));
+#endif
+			for (; i < n; i++)
+				dst[i] = toFloat(src[i]);
+		}
+
+		// the instruction set used by the array conversions
+		inline const char *simdName() {
+#if defined(GL_HALF_F16C)
+			return detail::hasF16C() ? "F16C" : "scalar";
+#elif defined(GL_HALF_NEON)
+			return "NEON";
+#else
+			return "scalar";
+#endif
+		}
+	}
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+
+#include "context.h"
+#include "fence.h"
+#include "program_cache.h"
+#include "render_executor.h"
+#include "render_target.h"
+#include "render_ticket.h"
+#include "state_cache.h"
+
+namespace gl {
+
+	/*
+	 * A graph of fragment shader passes (nodes) connected by textures (edges), all of the same size.
+	 * submit() renders the whole graph in topological order within one task on the executor.
+	 * Outputs of intermediate passes stay on the GPU and their render targets are reused once all
+	 * consumers ran, so a chain of passes needs only two of them. Only sinks (passes without
+	 * consumers) get readback buffers.
+	 */
+	template<typename T, int C>
+	class pipeline {
+	public:
+		typedef int node_id;
+
+	private:
+		struct input {
+			std::string uName;
+			texture_base *tex; // external texture
+			node_id from;      // or output of another pass
+			GLint uLoc = -1;
+		};
+
+		struct node {
+			std::string name, fragShaderSrc;
+			std::vector<input> inputs;
+			std::vector<node_id> consumers;
+			GLuint prog = 0;
+			render_target<T, C> *out = nullptr;
+			int lastUse = -1; // position of the last consumer in order
+		};
+
+		render_executor &executor;
+		int w, h;
+		std::vector<node> nodes;
+		std::vector<node_id> order;
+		std::vector<std::unique_ptr<render_target<T, C>>> targets;
+		int nIntermediateTargets = 0;
+		std::atomic<bool> alive;
+		std::chrono::milliseconds responseTimeout{4000};
+
+		// executor thread only
+		std::deque<std::pair<fence, render_ticket>> inFlight;
+
+	public:
+		pipeline(int width, int height, render_executor &executor)
+				: executor(executor), w(width), h(height), alive(false) {}
+
+		pipeline(const pipeline &) = delete;
+
+		~pipeline() {
+			if (!alive)
+				return;
+			try {
+				executor.run([this]() {
+					executor._removeIdleTask(this);
+					glFinish();
+					retire(true);
+					release();
+				}, responseTimeout);
+			}
+			catch (std::runtime_error &e) {
+				LOG_E << "~pipeline(): " << e.what();
+				// the cleanup did not run (to its end), nothing may poll the freed pipeline
+				render_executor *ex = &executor;
+				const void *owner = this;
+				executor.post([ex, owner]() { ex->_removeIdleTask(owner); });
+			}
+		}
+
+		inline int width() const { return w; }
+
+		inline int height() const { return h; }
+
+		/*
+		 * Time callers wait for the executor to run a call before giving up (default 4s)
+		 */
+		void setResponseTimeout(std::chrono::milliseconds timeout) { responseTimeout = timeout; }
+
+		node_id addPass(const std::string &name, const std::string &fragShaderSrc) {
+			if (alive)
+				throw std::logic_error("pipeline already started");
+			nodes.push_back({name, fragShaderSrc});
+			return (node_id) nodes.size() - 1;
+		}
+
+		// binds an external texture to a sampler uniform of pass
+		void addInput(node_id pass, const std::string &uniformName, texture_base &tex) {
+			checkNode(pass);
+			nodes[pass].inputs.push_back({uniformName, &tex, -1});
+		}
+
+		// binds the output of pass from to a sampler uniform of pass to
+		void connect(node_id from, node_id to, const std::string &uniformName) {
+			checkNode(from), checkNode(to);
+			nodes[to].inputs.push_back({uniformName, nullptr, from});
+			nodes[from].consumers.push_back(to);
+		}
+
+		/*
+		 * Sorts the graph, compiles the passes and allocates the render targets on the executor.
+		 */
+		void start() {
+			if (alive)
+				throw std::logic_error("pipeline already started");
+			sort();
+			executor.run([this]() {
+				try { init(); }
+				catch (std::exception &) {
+					release(); // e.g. a pass that does not compile, free what the others got
+					throw;
+				}
+			}, responseTimeout);
+			executor.post([this]() {
+				executor._addIdleTask(this, [this]() { return retire(false); });
+			});
+			alive = true;
+		}
+
+		/*
+		 * Renders all passes without waiting for the GPU, the ticket completes once it finished.
+		 */
+		render_ticket submit() {
+			if (!alive)
+				throw std::logic_error("pipeline is not started");
+			render_ticket done(-1u);
+			executor.post([this, done]() mutable {
+				try {
+					for (node_id id : order)
+						draw(nodes[id]);
+					executor.getContext().checkAndThrowError("pipeline::submit()");
+					inFlight.push_back({fence(), done});
+					inFlight.back().first.insert();
+				}
+				catch (std::runtime_error &e) {
+					LOG_E << "pipeline: " << e.what();
+					done._complete(e.what());
+				}
+			});
+			return done;
+		}
+
+		void getResult(node_id sink, T *dst) {
+			checkNode(sink);
+			if (!nodes[sink].consumers.empty())
+				throw std::logic_error("pipeline::getResult(): " + nodes[sink].name + " is not a sink");
+			executor.run([this, sink, dst]() {
+				nodes[sink].out->read(dst, w * h * C);
+			}, responseTimeout);
+		}
+
+		void getResult(node_id sink, HlBuf<T> &buffer) {
+			if (buffer.number_of_elements() != w * h * C)
+				throw std::runtime_error("getResult(): invalid buffer size");
+			getResult(sink, buffer.begin());
+		}
+
+		// render targets holding intermediate results, after start()
+		inline int intermediateTargetCount() const { return nIntermediateTargets; }
+
+	private:
+		void checkNode(node_id id) const {
+			if (id < 0 || id >= (node_id) nodes.size())
+				throw std::out_of_range("pipeline: invalid node " + std::to_string(id));
+		}
+
+		// Kahn's algorithm, also finds the last consumer of each pass
+		void sort() {
+			std::vector<int> nDeps(nodes.size(), 0);
+			for (auto &n : nodes)
+				for (auto &in : n.inputs)
+					if (in.tex == nullptr) ++nDeps[&n - &nodes[0]];
+
+			order.clear();
+			for (node_id i = 0; i < (node_id) nodes.size(); ++i)
+				if (nDeps[i] == 0) order.push_back(i);
+			for (size_t k = 0; k < order.size(); ++k)
+				for (node_id c : nodes[order[k]].consumers)
+					if (--nDeps[c] == 0) order.push_back(c);
+
+			if (order.size() != nodes.size())
+				throw std::logic_error("pipeline: graph has a cycle");
+
+			for (int pos = 0; pos < (int) order.size(); ++pos)
+				for (auto &in : nodes[order[pos]].inputs)
+					if (in.tex == nullptr) nodes[in.from].lastUse = pos;
+		}
+
+		void init() {
+			auto &gl(executor.getContext());
+			std::vector<render_target<T, C> *> unused;
+			for (int pos = 0; pos < (int) order.size(); ++pos) {
+				node &n(nodes[order[pos]]);
+
+				glsl_processor processor(sizeMacros(w, h));
+				n.prog = program_cache::get().build(gl, {{GL_VERTEX_SHADER, state_cache::fullscreenVertexShader()},
+														 {GL_FRAGMENT_SHADER, processor.process(n.fragShaderSrc)}});
+
+				for (auto &in : n.inputs) {
+					in.uLoc = glGetUniformLocation(n.prog, in.uName.c_str());
+					if (in.uLoc == -1)
+						LOG_W << "pipeline: uniform " << in.uName << " of " << n.name << " not found, ignore";
+					if (in.tex) in.tex->maybeInit();
+				}
+
+				if (n.consumers.empty()) {
+					targets.emplace_back(new render_target<T, C>(w, h, 1));
+					n.out = targets.back().get();
+					n.out->init(), n.out->clear();
+				} else if (!unused.empty()) {
+					n.out = unused.back();
+					unused.pop_back();
+				} else {
+					targets.emplace_back(new render_target<T, C>(w, h, 0));
+					n.out = targets.back().get();
+					n.out->init(), n.out->clear();
+					++nIntermediateTargets;
+				}
+
+				// targets of inputs read for the last time can be reused by the following passes
+				for (auto &in : n.inputs) {
+					if (in.tex || nodes[in.from].lastUse != pos)
+						continue;
+					auto t = nodes[in.from].out;
+					if (std::find(unused.begin(), unused.end(), t) == unused.end())
+						unused.push_back(t);
+				}
+			}
+			gl.checkAndThrowError("pipeline::start()");
+			LOG_I << "pipeline: " << nodes.size() << " passes, " << nIntermediateTargets
+				  << " intermediate targets";
+		}
+
+		// deletes the programs and targets, executor thread only
+		void release() {
+			for (auto &n : nodes) {
+				if (n.prog) state_cache::get().forgetProgram(n.prog), glDeleteProgram(n.prog), n.prog = 0;
+				n.out = nullptr;
+			}
+			for (auto &t : targets)
+				t->deinit();
+			targets.clear();
+			nIntermediateTargets = 0;
+		}
+
+		void draw(node &n) {
+			auto &state(state_cache::get());
+			state.useProgram(n.prog);
+			state.blend(false);
+			n.out->bind(true);
+			state.viewport(0, 0, w, h);
+			state.scissor(rect{0, 0, 0, 0});
+
+			int unit = 0;
+			for (auto &in : n.inputs) {
+				if (in.uLoc == -1)
+					continue;
+				texture_base &tex(in.tex ? *in.tex : nodes[in.from].out->texBuf);
+				state.bindTexture(unit, tex.getGlTarget(), tex.getGlId());
+				state.activeTexture(unit);
+				tex._preRender();
+				state.uniform1i(in.uLoc, unit++);
+			}
+			state.drawFullscreen();
+		}
+
+		// completes tickets of finished submissions, returns true while some are pending
+		bool retire(bool wait) {
+			while (!inFlight.empty()) {
+				if (!inFlight.front().first.wait(wait ? GL_TIMEOUT_IGNORED : 0))
+					break;
+				inFlight.front().second._complete();
+				inFlight.pop_front();
+			}
+			return !inFlight.empty();
+		}
+	};
+}
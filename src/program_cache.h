@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "context.h"
+#include "shared_context.h"
+
+namespace gl {
+
+	struct shader_stage {
+		GLenum type;
+		std::string src; // after macro processing
+	};
+
+	/*
+	 * Builds shader programs and keeps their binaries (glGetProgramBinary), so a program built before
+	 * is instantiated with glProgramBinary instead of compiling GLSL. Binaries are kept in memory for
+	 * the process, keyed by a hash of the stage sources and the driver (vendor, renderer, version),
+	 * which makes them usable on any context of the process, and optionally in a directory for later
+	 * starts. Binaries the driver rejects are dropped and rebuilt from source.
+	 *
+	 * Each build returns a separate program object, since uniforms are per program and users of equal
+	 * sources usually set them differently. Thread-safe, programs are created on the calling thread's
+	 * context. warmUp() builds programs ahead of their first use, in parallel.
+	 */
+	class program_cache {
+		struct binary {
+			std::string key; // to rule out hash collisions
+			GLenum format = 0;
+			std::vector<char> data;
+		};
+
+		std::mutex mutex;
+		std::string dir;
+		std::unordered_map<uint64_t, std::shared_ptr<const binary>> binaries;
+		std::atomic<uint32_t> nShared{0}, nLoaded{0}, nCompiled{0};
+
+		program_cache() = default;
+
+	public:
+		static program_cache &get() {
+			static program_cache cache;
+			return cache;
+		}
+
+		// enables the on-disk cache in dir (must exist), empty to disable
+		void setBinaryDirectory(const std::string &d) {
+			std::lock_guard<std::mutex> lock(mutex);
+			dir = d;
+		}
+
+		// drops the binaries kept in memory
+		void clear() {
+			std::lock_guard<std::mutex> lock(mutex);
+			binaries.clear();
+		}
+
+		// programs instantiated from a binary in memory, loaded from a file and compiled since the start
+		inline uint32_t sharedCount() const { return nShared; }
+
+		inline uint32_t loadedCount() const { return nLoaded; }
+
+		inline uint32_t compiledCount() const { return nCompiled; }
+
+		GLuint build(context &gl, const std::vector<shader_stage> &stages) {
+			GLint nFormats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+			if (nFormats == 0) {
+				++nCompiled;
+				return compile(gl, stages, false);
+			}
+
+			std::string key = keyOf(driverId(), stages);
+			uint64_t h = hash(key);
+
+			std::shared_ptr<const binary> b;
+			std::string fileName;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = binaries.find(h);
+				if (it != binaries.end() && it->second->key == key)
+					b = it->second;
+				else if (!dir.empty()) {
+					char hex[17];
+					snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) h);
+					fileName = dir + "/" + hex + ".glprog";
+				}
+			}
+
+			if (b) {
+				GLuint p = instantiate(*b);
+				if (p) {
+					++nShared;
+					return p;
+				}
+			} else if (!fileName.empty() && (b = readFile(fileName, key))) {
+				GLuint p = instantiate(*b);
+				if (p) {
+					++nLoaded;
+					keep(h, b);
+					return p;
+				}
+				LOG_W << "program_cache: driver rejected " << fileName << ", rebuilding";
+				std::remove(fileName.c_str());
+			}
+
+			GLuint p = compile(gl, stages, true);
+			++nCompiled;
+			b = retrieve(p, key);
+			if (b) {
+				keep(h, b);
+				if (!fileName.empty())
+					writeFile(fileName, *b);
+			}
+			return p;
+		}
+
+		/*
+		 * Compiles programs in parallel and keeps their binaries, so building them later is a lookup.
+		 * With threads 0 it uses GL_KHR_parallel_shader_compile if the driver has it, otherwise (or
+		 * with threads > 0) worker threads on shared contexts, by default one per core. On a thread
+		 * with a current context, e.g. in a render_executor task. Programs failing to build are logged
+		 * and skipped, returns the number of programs built.
+		 */
+		int warmUp(context &gl, const std::vector<std::vector<shader_stage>> &programs, int threads = 0) {
+			GLint nFormats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+			if (nFormats == 0) {
+				LOG_W << "program_cache: no program binary formats, cannot warm up";
+				return 0;
+			}
+
+			std::string driver = driverId();
+			std::vector<const std::vector<shader_stage> *> todo;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				std::set<uint64_t> queued;
+				for (auto &stages : programs) {
+					uint64_t h = hash(keyOf(driver, stages));
+					if (!binaries.count(h) && queued.insert(h).second)
+						todo.push_back(&stages);
+				}
+			}
+			if (todo.empty())
+				return 0;
+
+			auto ext = (const char *) glGetString(GL_EXTENSIONS);
+			if (threads == 0 && ext && strstr(ext, "GL_KHR_parallel_shader_compile"))
+				return compileConcurrently(driver, todo);
+
+			if (threads <= 0)
+				threads = (int) std::max(1u, std::thread::hardware_concurrency());
+			threads = std::min(threads, (int) todo.size());
+			std::vector<std::unique_ptr<shared_context>> contexts;
+			for (int i = 0; i < threads; ++i)
+				contexts.emplace_back(new shared_context());
+
+			std::atomic<size_t> next{0};
+			std::atomic<int> built{0};
+			std::vector<std::thread> workers;
+			for (int i = 0; i < threads; ++i) {
+				workers.emplace_back([&, i]() {
+					try { contexts[i]->makeCurrent(); }
+					catch (std::runtime_error &e) {
+						LOG_E << "program_cache: " << e.what();
+						return;
+					}
+					for (size_t k; (k = next++) < todo.size();) {
+						try {
+							glDeleteProgram(build(gl, *todo[k]));
+							++built;
+						}
+						catch (std::runtime_error &e) {
+							LOG_E << "program_cache: warm-up of a program failed: " << e.what();
+							while (glGetError() != GL_NO_ERROR);
+						}
+					}
+					contexts[i]->release();
+				});
+			}
+			for (auto &t : workers)
+				t.join();
+			return built;
+		}
+
+		// FNV-1a, stable across processes (unlike std::hash)
+		static uint64_t hash(const std::string &s) {
+			uint64_t h = 14695981039346656037ull;
+			for (unsigned char c : s)
+				h = (h ^ c) * 1099511628211ull;
+			return h;
+		}
+
+	private:
+		static std::string driverId() {
+			std::string id;
+			for (GLenum e : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+				auto s = (const char *) glGetString(e);
+				id += std::string(s ? s : "") + '\n';
+			}
+			return id;
+		}
+
+		static std::string keyOf(const std::string &driver, const std::vector<shader_stage> &stages) {
+			std::string key = driver;
+			for (auto &s : stages)
+				key += std::to_string(s.type) + '\n' + s.src + '\n';
+			return key;
+		}
+
+		static GLuint compile(context &gl, const std::vector<shader_stage> &stages, bool retrievable) {
+			std::vector<GLuint> shaders;
+			for (auto &s : stages)
+				shaders.push_back(gl.LoadShader(s.type, s.src));
+			GLuint p;
+			try { p = gl.Link(shaders, retrievable); }
+			catch (std::runtime_error &) {
+				for (GLuint s : shaders) glDeleteShader(s);
+				throw;
+			}
+			for (GLuint s : shaders) glDeleteShader(s);
+			return p;
+		}
+
+		/*
+		 * Issues all compiles and links before querying any status, so a driver with
+		 * KHR_parallel_shader_compile builds them on its own threads meanwhile.
+		 */
+		int compileConcurrently(const std::string &driver, const std::vector<const std::vector<shader_stage> *> &todo) {
+			auto maxCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) eglGetProcAddress(
+					"glMaxShaderCompilerThreadsKHR");
+			if (maxCompilerThreads)
+				maxCompilerThreads(0xFFFFFFFF); // as many as the driver likes
+
+			std::vector<std::pair<GLuint, std::vector<GLuint>>> jobs;
+			for (auto *stages : todo) {
+				GLuint p = glCreateProgram();
+				std::vector<GLuint> shaders;
+				for (auto &s : *stages) {
+					GLuint sh = glCreateShader(s.type);
+					const char *src = s.src.c_str();
+					glShaderSource(sh, 1, &src, nullptr);
+					glCompileShader(sh);
+					glAttachShader(p, sh);
+					shaders.push_back(sh);
+				}
+				glProgramParameteri(p, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+				glLinkProgram(p);
+				jobs.emplace_back(p, shaders);
+			}
+
+			int built = 0;
+			for (size_t k = 0; k < jobs.size(); ++k) {
+				GLuint p = jobs[k].first;
+				GLint linked = 0;
+				glGetProgramiv(p, GL_LINK_STATUS, &linked);
+				if (linked) {
+					auto b = retrieve(p, keyOf(driver, *todo[k]));
+					if (b) keep(hash(b->key), b), ++built;
+					++nCompiled;
+				} else {
+					char log[1024] = "";
+					glGetProgramInfoLog(p, sizeof(log), nullptr, log);
+					LOG_E << "program_cache: warm-up of a program failed: " << log;
+				}
+				for (GLuint sh : jobs[k].second)
+					glDeleteShader(sh);
+				glDeleteProgram(p);
+			}
+			while (glGetError() != GL_NO_ERROR);
+			return built;
+		}
+
+		void keep(uint64_t h, std::shared_ptr<const binary> b) {
+			std::lock_guard<std::mutex> lock(mutex);
+			binaries[h] = std::move(b);
+		}
+
+		static GLuint instantiate(const binary &b) {
+			GLuint p = glCreateProgram();
+			glProgramBinary(p, b.format, b.data.data(), (GLsizei) b.data.size());
+			GLint linked = 0;
+			glGetProgramiv(p, GL_LINK_STATUS, &linked);
+			if (glGetError() != GL_NO_ERROR || !linked) {
+				glDeleteProgram(p);
+				return 0;
+			}
+			return p;
+		}
+
+		static std::shared_ptr<const binary> retrieve(GLuint p, const std::string &key) {
+			GLint len = 0;
+			glGetProgramiv(p, GL_PROGRAM_BINARY_LENGTH, &len);
+			if (len <= 0) {
+				LOG_V << "program_cache: no program binary available";
+				return nullptr;
+			}
+			std::shared_ptr<binary> b(new binary);
+			b->key = key;
+			b->data.resize(len);
+			glGetProgramBinary(p, len, &len, &b->format, b->data.data());
+			if (glGetError() != GL_NO_ERROR)
+				return nullptr;
+			b->data.resize(len);
+			return b;
+		}
+
+		/*
+		 * File layout: key length, key, binary format, binary.
+		 */
+		static std::shared_ptr<const binary> readFile(const std::string &fileName, const std::string &key) {
+			std::ifstream f(fileName, std::ios::binary);
+			if (!f)
+				return nullptr;
+			uint64_t keyLen = 0;
+			f.read((char *) &keyLen, sizeof(keyLen));
+			if (!f || keyLen != key.size())
+				return nullptr;
+			std::shared_ptr<binary> b(new binary);
+			b->key.resize(keyLen);
+			f.read(&b->key[0], keyLen);
+			f.read((char *) &b->format, sizeof(b->format));
+			b->data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+			if (b->key != key || b->data.empty())
+				return nullptr;
+			return b;
+		}
+
+		static void writeFile(const std::string &fileName, const binary &b) {
+			// write to a temporary file first, so concurrent processes never see partial files
+			std::string tmp = fileName + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+			{
+				std::ofstream f(tmp, std::ios::binary);
+				uint64_t keyLen = b.key.size();
+				f.write((const char *) &keyLen, sizeof(keyLen));
+				f.write(b.key.data(), keyLen);
+				f.write((const char *) &b.format, sizeof(b.format));
+				f.write(b.data.data(), b.data.size());
+				if (!f) {
+					LOG_W << "program_cache: cannot write " << tmp;
+					std::remove(tmp.c_str());
+					return;
+				}
+			}
+			std::rename(tmp.c_str(), fileName.c_str());
+		}
+	};
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+
+#include "context.h"
+#include "program_cache.h"
+#include "render_target.h"
+#include "state_cache.h"
+
+namespace gl {
+
+	/*
+	 * Computes the largest absolute difference of two textures of the same size on the GPU, e.g. to
+	 * check an iterative solver for convergence. A first pass reduces 4x4 blocks of differences into
+	 * an fp32 target, further passes reduce that by 4x4 blocks down to one pixel, which is the only
+	 * thing read back. Render thread only.
+	 */
+	template<typename T, int C>
+	class max_abs_diff {
+		int w, h;
+		GLuint diffProg = 0, reduceProg = 0;
+		GLint uDiffBlock = -1, uReduceBlock = -1;
+
+		struct level {
+			render_target<float, 4> out;
+			int bx, by; // block size reduced into one pixel
+		};
+		std::vector<std::unique_ptr<level>> levels;
+
+	public:
+		max_abs_diff(int width, int height) : w(width), h(height) {}
+
+		max_abs_diff(const max_abs_diff &) = delete;
+
+		void init(context &gl) {
+			std::string prefix = is_float_texel<T>::value ? "" : std::is_signed<T>::value ? "i" : "u";
+			diffProg = link(gl, "#define DIFF\nuniform highp " + prefix + "sampler2D u_a, u_b;\n");
+			uDiffBlock = glGetUniformLocation(diffProg, "u_block");
+			reduceProg = link(gl, "uniform highp sampler2D u_a;\n");
+			uReduceBlock = glGetUniformLocation(reduceProg, "u_block");
+
+			// levels keep at least 4 pixels per row while taller than 2 rows (see texture2d)
+			for (int lw = w, lh = h; lw > 1 || lh > 1;) {
+				int by = 4, bx = ((lw + 3) / 4 >= 4 || (lh + 3) / 4 <= 2) ? 4 : 1;
+				lw = (lw + bx - 1) / bx, lh = (lh + by - 1) / by;
+				levels.emplace_back(new level{{lw, lh, 0}, bx, by});
+				levels.back()->out.init(), levels.back()->out.clear();
+			}
+			gl.checkAndThrowError("max_abs_diff::init()");
+		}
+
+		void deinit() {
+			for (GLuint p : {diffProg, reduceProg})
+				if (p) state_cache::get().forgetProgram(p), glDeleteProgram(p);
+			diffProg = reduceProg = 0;
+			for (auto &l : levels)
+				l->out.deinit();
+			levels.clear();
+		}
+
+		inline bool initialized() const { return diffProg != 0; }
+
+		// issues the passes and waits for the result
+		float run(texture_base &a, texture_base &b) {
+			auto &state(state_cache::get());
+			state.blend(false);
+			state.scissor(rect{0, 0, 0, 0});
+
+			texture_base *src = nullptr;
+			for (auto &l : levels) {
+				state.useProgram(src ? reduceProg : diffProg);
+				glUniform2i(src ? uReduceBlock : uDiffBlock, l->bx, l->by);
+				l->out.bind();
+				state.viewport(0, 0, l->out.width(), l->out.height());
+				state.bindTexture(0, GL_TEXTURE_2D, src ? src->getGlId() : a.getGlId());
+				if (!src) state.bindTexture(1, GL_TEXTURE_2D, b.getGlId());
+				state.drawFullscreen();
+				src = &l->out.texBuf;
+			}
+
+			GLfloat v[4] = {0, 0, 0, 0};
+			glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, v);
+			state.count(2);
+			gl::context::checkAndThrowError("max_abs_diff::run()");
+			return v[0];
+		}
+
+	private:
+		static GLuint link(context &gl, const std::string &decl) {
+			std::string src = "#version 300 es\nprecision highp float;\n#define CHANNELS " + std::to_string(C) +
+							  "\n" + decl + R"GLSL(
+uniform ivec2 u_block;
+out vec4 color;
+void main() {
+	ivec2 size = textureSize(u_a, 0);
+	ivec2 base = ivec2(gl_FragCoord.xy) * u_block;
+	float m = 0.0;
+	for (int y = 0; y < u_block.y; ++y) {
+		for (int x = 0; x < u_block.x; ++x) {
+			ivec2 p = base + ivec2(x, y);
+			if (p.x >= size.x || p.y >= size.y) continue;
+#ifdef DIFF
+			vec4 d = abs(vec4(texelFetch(u_a, p, 0)) - vec4(texelFetch(u_b, p, 0)));
+			for (int c = 0; c < CHANNELS; ++c) m = max(m, d[c]);
+#else
+			m = max(m, texelFetch(u_a, p, 0).r);
+#endif
+		}
+	}
+	color = vec4(m);
+}
+)GLSL";
+			GLuint p = program_cache::get().build(gl, {{GL_VERTEX_SHADER, state_cache::fullscreenVertexShader()},
+													   {GL_FRAGMENT_SHADER, src}});
+
+			state_cache::get().useProgram(p);
+			glUniform1i(glGetUniformLocation(p, "u_a"), 0);
+			glUniform1i(glGetUniformLocation(p, "u_b"), 1);
+			return p;
+		}
+	};
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "command_queue.h"
+#include "context.h"
+#include "render_ticket.h"
+#include "state_cache.h"
+
+namespace gl {
+
+	/*
+	 * A render thread with one GL context, shared by many renderer2d (see renderer2d::setExecutor()).
+	 * Renderers become jobs posted to its queue instead of each owning a thread and a context,
+	 * and their programs, targets and textures all live on the executor's context.
+	 * Renderers must be destroyed before their executor.
+	 */
+	class render_executor {
+		context gl;
+		std::thread thread;
+		command_queue<std::function<void()>> tasks;
+
+		// executor thread only
+		std::vector<std::pair<const void *, std::function<bool()>>> idleTasks;
+		bool alive = true;
+
+	public:
+		explicit render_executor(context &gl, size_t queueSize = 256) : gl(gl), tasks(queueSize) {
+			render_ticket initDone(-1u);
+			thread = std::thread([this, initDone]() mutable { run(initDone); });
+			try { initDone.wait(); }
+			catch (std::runtime_error &) {
+				thread.join();
+				throw;
+			}
+		}
+
+		render_executor(const render_executor &) = delete;
+
+		~render_executor() {
+			post([this]() { alive = false; });
+			thread.join();
+		}
+
+		inline context &getContext() { return gl; }
+
+		/*
+		 * Queues task to run on the executor thread, safe to call from any thread.
+		 * Tasks report their own errors, exceptions escaping a task are only logged.
+		 */
+		void post(std::function<void()> task) {
+			tasks.push(std::move(task));
+		}
+
+		/*
+		 * Runs f on the executor thread and waits up to timeout for it, errors of f are rethrown as
+		 * std::runtime_error. On a timeout f is cancelled if it did not start yet, or waited for if it
+		 * runs, so f may use the caller's state. Not from the executor thread.
+		 */
+		void run(std::function<void()> f, std::chrono::milliseconds timeout) {
+			struct call {
+				std::mutex mutex;
+				bool cancelled = false;
+			};
+			auto c = std::make_shared<call>();
+			render_ticket done(-1u);
+			post([f, c, done]() mutable {
+				std::lock_guard<std::mutex> lock(c->mutex);
+				if (c->cancelled)
+					return;
+				try { f(), done._complete(); }
+				catch (std::exception &e) { done._complete(e.what()); }
+			});
+			try { done.wait(timeout); }
+			catch (std::runtime_error &) {
+				std::lock_guard<std::mutex> lock(c->mutex);
+				c->cancelled = true;
+				throw;
+			}
+		}
+
+		/*
+		 * Registers poll to run while the executor is idle, e.g. to retire finished frames. poll returns
+		 * true as long as it has pending work. Executor thread only.
+		 */
+		void _addIdleTask(const void *owner, std::function<bool()> poll) {
+			idleTasks.emplace_back(owner, std::move(poll));
+		}
+
+		void _removeIdleTask(const void *owner) {
+			for (auto it = idleTasks.begin(); it != idleTasks.end();)
+				it = (it->first == owner) ? idleTasks.erase(it) : std::next(it);
+		}
+
+	private:
+		void run(render_ticket initDone) {
+			try {
+				gl.initForThisThread();
+				state_cache::get().invalidate();
+			}
+			catch (std::runtime_error &e) {
+				LOG_E << "render_executor: init failed: " << e.what();
+				initDone._complete(e.what());
+				return;
+			}
+			initDone._complete();
+
+			using namespace std::chrono_literals;
+			std::function<void()> task;
+			bool busy = false;
+			while (alive) {
+				if (!tasks.pop(task, busy ? std::chrono::nanoseconds(200us) : 1s)) {
+					busy = false;
+					for (auto &t : idleTasks)
+						busy |= t.second();
+					continue;
+				}
+
+				try { task(); }
+				catch (std::exception &e) {
+					LOG_E << "render_executor: exception in task: " << e.what();
+				}
+				task = nullptr;
+				busy = true; // poll idle tasks soon after work arrived
+			}
+
+			glFinish();
+			gl.deinitForThisThread();
+		}
+	};
+}
@@ -1,35 +1,105 @@
 #pragma once
 
+#include "fence.h"
+#include "state_cache.h"
 #include "texture/texture_pbo.h"
 
 namespace gl {
 
 	/*
-	 * Wraps a framebuffer, texture and pack buffer for direct read access to drawn pixels
+	 * Wraps a framebuffer, texture and a ring of pack buffers for direct read access to drawn pixels.
+	 * With more than one pack buffer, downloads of consecutive frames can overlap (see readAsync())
 	 */
 	template<typename T, int C>
 	struct render_target {
-		GLuint fb;
+		GLuint fb = 0;
 		texture_pbo<T,C> texBuf;
+		bool complete = false;
 
-		render_target(int width, int height)
-				: texBuf{"out", width, height, buf_use::to_cpu()} {}
+	private:
+		struct readback_slot {
+			pack_buffer<T, C> pb;
+			fence done;
+			bool pending;
+			size_t bytes;
+		};
+		std::vector<readback_slot> readbackRing;
+		int nextReadSlot = 0;
+
+	public:
+		render_target(int width, int height, int readbackSlots = 2)
+				: texBuf{"out", width, height, buf_use{false, false, true, true}} {
+			setReadbackRingSize(readbackSlots);
+		}
 
 		inline int width() { return texBuf.width; }
 		inline int height() { return texBuf.height; }
 
+		// without readback slots (k = 0) the target stays on the GPU and cannot be read
+		void setReadbackRingSize(int k) {
+			if (k < 0)
+				throw std::invalid_argument("render_target: negative readback ring size");
+			if (!readbackRing.empty() && readbackRing.front().pb.pbo != 0)
+				throw std::logic_error("render_target: cannot resize readback ring after init");
+
+			readbackRing.clear();
+			for (int i = 0; i < k; i++)
+				readbackRing.push_back({{width(), height(), buf_use::to_cpu()}, fence(), false, 0});
+			nextReadSlot = 0;
+		}
+
+		inline int readbackRingSize() const { return (int) readbackRing.size(); }
+
+		// throws if resize(w, h) would fail, without changing anything
+		void checkResize(int w, int h) {
+			texture2d<T, C>::checkRowStride(w, h);
+			for (auto &s : readbackRing) {
+				if (s.pending)
+					throw std::logic_error("render_target::resize(): readback pending");
+			}
+		}
+
+		/*
+		 * Changes the size, on the GL thread once initialized, without reads pending. The texture gets
+		 * new storage (cleared), pack buffers are reused if large enough.
+		 */
+		void resize(int w, int h) {
+			checkResize(w, h);
+			for (auto &s : readbackRing)
+				s.pb.resize(w, h);
+			texBuf.resize(w, h);
+			if (fb != 0) {
+				complete = false;
+				clear(); // attaches the new texture
+			}
+		}
+
 		void init() {
 			glGenFramebuffers(1, &fb);
 			gl::context::checkAndThrowError("renderer2d GenFramebuffers");
 
 			texBuf.init();
+			for (auto &s : readbackRing)
+				s.pb.init();
+		}
+
+		void deinit() {
+			if (fb == 0)
+				return;
+			state_cache::get().forgetFramebuffer(fb);
+			glDeleteFramebuffers(1, &fb), fb = 0;
+			state_cache::get().forgetTexture(texBuf.getGlId());
+			texBuf.deinit();
+			for (auto &s : readbackRing)
+				s.done.reset(), s.pending = false, s.pb.deinit();
+			complete = false;
 		}
 
 		void bind(bool checkCompleteness = false) {
-			glBindFramebuffer(GL_FRAMEBUFFER, fb);
+			state_cache::get().bindFramebuffer(fb);
 			texBuf._preRenderTarget();
 
-			if(checkCompleteness) {
+			if (checkCompleteness && !complete) {
 				auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 				gl::context::checkAndThrowError("render(): CheckFramebufferStatus");
 				if (status != GL_FRAMEBUFFER_COMPLETE) {
@@ -37,6 +107,7 @@ namespace gl {
 						  << texBuf.to_string();
 					throw std::runtime_error("framebuffer error");
 				}
+				complete = true; // the attachment never changes, check once
 				//LOG_V << "gl::renderer2d(frame=" << frameIndex << "): framebuffer complete with target "
 				//	  << target.tex.to_string();
 			}
@@ -46,16 +117,62 @@ namespace gl {
 			bind();
 			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texBuf.getGlTarget(), texBuf.getGlId(), 0);
 			gl::context::checkAndThrowError("render(): glFramebufferTexture2D ", texBuf);
+			state_cache::get().scissor(rect{0, 0, 0, 0});
 			glClearColor(0.0, 0.0, 0.0, 0.0);
 			glClear(GL_COLOR_BUFFER_BIT);
 		}
 
+		/*
+		 * Kicks off the download of the current content into the next pack buffer of the ring and returns
+		 * its slot without waiting for the GPU. Pass the slot to finishRead() to map the pixels.
+		 */
+		int readAsync() {
+			return readAsync(rect{0, 0, width(), height()});
+		}
+
+		// as readAsync(), but only the pixels in r. Pack buffers are mapped only as far as needed
+		int readAsync(const rect &r) {
+			if (r.empty() || !r.inside(width(), height()))
+				throw std::runtime_error("render_target::readAsync(): invalid rect");
+			if (readbackRing.empty())
+				throw std::logic_error("render_target::readAsync(): GPU-only target without readback slots");
+			int slot = nextReadSlot;
+			auto &s(readbackRing[slot]);
+			if (s.pending)
+				throw std::logic_error("render_target::readAsync(): readback ring overrun");
+
+			bind();
+			if (r.width == width() && r.height == height())
+				s.pb.pack(texBuf), s.bytes = s.pb.sizeBytes;
+			else
+				s.bytes = s.pb.pack(texBuf, r);
+			s.done.insert();
+			s.pending = true;
+
+			nextReadSlot = (slot + 1) % readbackRing.size();
+			return slot;
+		}
+
+		inline bool readReady(int slot) { return readbackRing[slot].done.poll(); }
+
+		inline bool readRingFull() { return !readbackRing.empty() && readbackRing[nextReadSlot].pending; }
+
+		void finishRead(int slot, std::function<void(const T *src)> &reader) {
+			auto &s(readbackRing[slot]);
+			if (!s.pending)
+				throw std::logic_error("render_target::finishRead(): slot not pending");
+
+			s.done.wait(GL_TIMEOUT_IGNORED);
+			s.pending = false;
+			s.pb.map(reader, nullptr, s.bytes);
+		}
+
 		void read(std::function<void(const T *src)> &reader, int n) {
 			size_t nBytes = sizeof(T) * C * texBuf.width * texBuf.height;
 			if (n * sizeof(T) != nBytes) {
 				throw std::runtime_error("render_target::read(): invalid buf size");
 			}
-			texBuf.read(reader, n);
+			finishRead(readAsync(), reader);
 		}
 
 
@@ -65,7 +182,22 @@ namespace gl {
 				throw std::runtime_error("render_target::read(): invalid buf size");
 			}
 			std::function<void(const T *src)> reader = [dst, nBytes](const T *src) { memcpy(dst, src, nBytes); };
-			texBuf.read(reader, n);
+			finishRead(readAsync(), reader);
+		}
+
+		/*
+		 * Reads the pixels in r into dst, with rows dstStride pixels apart (0 for r.width).
+		 */
+		void read(const rect &r, T *dst, int dstStride = 0) {
+			if (dstStride == 0) dstStride = r.width;
+			if (dstStride < r.width)
+				throw std::runtime_error("render_target::read(): stride smaller than rect width");
+			size_t rowBytes = sizeof(T) * C * r.width;
+			std::function<void(const T *src)> reader = [&r, dst, dstStride, rowBytes](const T *src) {
+				for (int y = 0; y < r.height; ++y)
+					memcpy(dst + (size_t) y * dstStride * C, src + (size_t) y * r.width * C, rowBytes);
+			};
+			finishRead(readAsync(r), reader);
 		}
 	};
 }
\ No newline at end of file
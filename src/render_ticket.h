@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+
+#include <pclog/pclog.h>
+
+#include "command_queue.h"
+
+namespace gl {
+
+	/*
+	 * Completion handle of a command sent to the render thread, e.g. a frame submitted with
+	 * renderer2d::submit(), which completes once the GPU signaled the frame's fence.
+	 */
+	class render_ticket {
+		struct state {
+			wake_word done;
+			std::atomic<uint32_t> waiters{0};
+			std::atomic<uint32_t> frame;
+			std::string error;
+
+			state(uint32_t frame) : frame(frame) {}
+		};
+
+		std::shared_ptr<state> s;
+
+	public:
+		render_ticket() = default;
+
+		explicit render_ticket(uint32_t frame) : s(std::make_shared<state>(frame)) {}
+
+		inline bool valid() const { return s != nullptr; }
+
+		inline uint32_t frameIndex() const { return s ? s->frame.load() : (uint32_t) -1; }
+
+		inline bool done() const { return !s || s->done.load(); }
+
+		/*
+		 * Returns whether the frame completed, without blocking. Throws if the render thread failed it.
+		 */
+		bool poll() const {
+			if (!done())
+				return false;
+			if (s && !s->error.empty())
+				throw std::runtime_error("render_ticket::poll(): " + s->error);
+			return true;
+		}
+
+		/*
+		 * Blocks until the frame completed on the GPU. Throws if the render thread failed the frame
+		 * or did not respond within timeout.
+		 */
+		void wait(std::chrono::milliseconds timeout = std::chrono::milliseconds(4000)) const {
+			if (!s) return;
+			auto deadline = std::chrono::steady_clock::now() + timeout;
+			s->waiters.fetch_add(1);
+			while (!s->done.load()) {
+				auto left = deadline - std::chrono::steady_clock::now();
+				if (left.count() <= 0 || !s->done.wait(0, left)) {
+					if (s->done.load()) break;
+					s->waiters.fetch_sub(1);
+					LOG_E << "Timed out waiting for frame " << frameIndex();
+					throw std::runtime_error("render_ticket::wait(): render thread not responding");
+				}
+			}
+			s->waiters.fetch_sub(1);
+			if (!s->error.empty())
+				throw std::runtime_error("render_ticket::wait(): " + s->error);
+		}
+
+		void _setFrameIndex(uint32_t frame) { s->frame = frame; }
+
+		void _complete(const std::string &error = "") {
+			s->error = error;
+			s->done.store(1);
+			if (s->waiters.load())
+				s->done.wakeAll();
+		}
+	};
+}
@@ -1,14 +1,30 @@
 #pragma once
 
 #include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
 
+#include "command_queue.h"
 #include "context.h"
+#include "event_fd.h"
+#include "fence.h"
+#include "program_cache.h"
+#include "reduction.h"
+#include "render_executor.h"
 #include "render_target.h"
+#include "render_ticket.h"
+#include "shader_watcher.h"
+#include "state_cache.h"
 #include "texture/texture2d.h"
 #include "tools.h"
+#include "triple_buffer.h"
+#include "uniform_params.h"
 
 #ifdef ANDROID
 #include "texture/texture_buffer_android.h"
+#else
+#include "texture/texture_buffer_persistent.h"
 #endif
 
 namespace gl {
@@ -17,15 +33,8 @@ namespace gl {
 	template<typename T, int C>
 	using texture_dma = texture_buffer_android<T, C>;
 #else
-	//template<typename T, int C>
-	//using texture_dma = texture2d<T, C>;
-
 	template<typename T, int C>
-	class texture_dma : public texture2d<T, C> {
-	public:
-		texture_dma(const std::string name, int width, int height, gl::buf_use use)
-				: texture2d<T, C>(name, width, height) {}
-	};
+	using texture_dma = texture_buffer_persistent<T, C>;
 #endif
 
 	template<typename T, int C>
@@ -43,35 +52,78 @@ namespace gl {
 
 
 	private:
-		// render thread & sync
+		// render thread & commands
+		struct command {
+			enum kind_t { render, submit, stream, read, read_fn, update_uniforms, call, shutdown };
+
+			kind_t kind;
+			render_ticket done, frame;
+			T *dst;
+			rect roi{0, 0, 0, 0}; // empty for the whole frame
+			int dstStride = 0;
+			std::function<void(const T *src)> *reader = nullptr;
+			std::function<void(GLuint program)> update;
+			std::function<void()> task;
+
+			command(kind_t kind = render, T *dst = nullptr) : kind(kind), dst(dst) {}
+		};
 		std::thread renderThread;
 		std::atomic<bool> alive;
-		bool ready = false, rendered = false;
-		std::condition_variable cv;
-		std::mutex mtx;
+		command_queue<command> commands;
+		std::chrono::milliseconds responseTimeout{4000};
+		render_executor *executor = nullptr;
+		Stopwatch *sw = nullptr;
 		uint32_t frameIndex = -1;
 
 		// shader program
 		GLuint prog = 0;
+		uint32_t progGeneration = 0; // bumped for every new prog, GL reuses names of deleted programs
 		std::string fragShaderSrc;
 		std::string watchedFragFileName;
 		bool usingFallbackFragment = false;
+		std::unique_ptr<shader_watcher> watcher; // rebuilds the watched file in the background
+		std::atomic<uint64_t> watchedSize{0}; // the frame size the watcher builds for, see sizeTag()
 
+	protected:
 		// input
 		std::vector<texture_bind> inputBindings;
 		std::function<void(void)> updateTexturesExternal;
 
 		// output
 		bool accumulate = false;
-		texture_bind *feedbackInput = nullptr;
+		int feedbackIndex = -1; // input bound to the previous output
 		render_target<T,C> target, target2;
-		std::atomic<T *> readBuffer;
-		std::function<void(const T *src)> *reader = nullptr;
 
-		const char *vShaderSrc = R"GLSL(#version 300 es
-layout(location = 0) in mediump vec2 position;
-void main() {gl_Position = vec4(position, 0.0, 1.0);}
-)GLSL";
+	private:
+		struct output_bind {
+			texture_base &tex;
+			std::function<void()> init, deinit;
+			std::function<void(int w, int h)> resize, checkResize;
+		};
+		std::vector<output_bind> extraOutputs; // GL_COLOR_ATTACHMENT1...
+
+		// frames in flight (pipelined submission)
+		struct frame_in_flight {
+			fence done;
+			render_ticket ticket;
+			render_target<T, C> *readTarget = nullptr;
+			int readSlot = -1;
+			T *dst = nullptr;
+			bool streamed = false; // read into streamOut
+		};
+		std::deque<frame_in_flight> inFlight;
+		std::atomic<int> maxFramesInFlight{2};
+		std::atomic<event_fd *> completions{nullptr}; // created by getCompletionFd()
+		std::unique_ptr<max_abs_diff<T, C>> changeReduction; // renderIterations() convergence checks
+		uniform_params params; // setUniform()
+
+		// streaming mode (see enableStreaming())
+		std::unique_ptr<triple_buffer<uint8_t>> streamIn;
+		std::unique_ptr<triple_buffer<T>> streamOut;
+		std::function<void(const uint8_t *frame)> streamUpload;
+		std::atomic<bool> streamKick{false};
+		std::atomic<uint64_t> nStreamed{0}, nDropped{0};
+		uint32_t glCallsFrame = 0;
 
 		const char *fErrorShaderSrc = R"GLSL(#version 300 es
 out mediump vec4 color; void main() {
@@ -83,130 +135,182 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 
 		void compileShaders() {
 			LOG_V << "compileShaders()... ";
-			if (prog != 0) glDeleteProgram(prog);
+			if (prog != 0) state_cache::get().forgetProgram(prog), glDeleteProgram(prog);
 
-			glsl_processor processor;
-			processor.d("$width", width()), processor.d("$height", height());
-			processor.d("WIDTH", width()), processor.d("HEIGHT", height());
-
-			auto vertexShader = gl.LoadShader(GL_VERTEX_SHADER, vShaderSrc);
-			auto fragmentShader = gl.LoadShader(GL_FRAGMENT_SHADER, processor.process(fragShaderSrc));
-			prog = gl.Link({vertexShader, fragmentShader});
-			glDeleteShader(vertexShader), glDeleteShader(fragmentShader);
+			prog = buildProgram(fragShaderSrc), ++progGeneration;
 			gl.checkAndThrowError("compileShaders(): glDeleteShader");
-
-			std::string().swap(fragShaderSrc); // free
 		}
 
-	public:
-		explicit renderer2d(int width, int height, const std::string &fragShaderSrc, context &gl)
-				: fragShaderSrc(fragShaderSrc), gl(gl),
-				  alive(false), readBuffer(nullptr), target(width, height), target2(width, height) {
+		GLuint buildProgram(const std::string &src) {
+			return buildProgram(src, width(), height());
 		}
 
-		~renderer2d() {
-			{
-				std::lock_guard<std::mutex> lk(mtx);
-				alive = false,	ready = true;
-			}
-			cv.notify_one();
-			renderThread.join();
+		GLuint buildProgram(const std::string &src, int w, int h) {
+			glsl_processor processor(sizeMacros(w, h));
+			return linkProgram(processor, src);
 		}
 
-		inline int width() { return target.width(); }
+	public:
+		// the program a renderer of w x h builds for a fragment shader source, for program_cache::warmUp()
+		static std::vector<shader_stage> programStages(const std::string &fragSrc, int w, int h) {
+			glsl_processor processor(sizeMacros(w, h));
+			return {{GL_VERTEX_SHADER, state_cache::fullscreenVertexShader()},
+					{GL_FRAGMENT_SHADER, processor.process(fragSrc)}};
+		}
 
-		inline int height() { return target.height(); }
+	protected:
+		// builds the program from the shader source, macros are expanded by processor
+		virtual GLuint linkProgram(glsl_processor &processor, const std::string &src) {
+			return program_cache::get().build(gl, {{GL_VERTEX_SHADER, state_cache::fullscreenVertexShader()},
+												   {GL_FRAGMENT_SHADER, processor.process(src)}});
+		}
 
-		void renderThreadBody(Stopwatch *sw) {
-			gl.initForThisThread();
+		// issues the work of a frame, with program, inputs and the framebuffer of target bound
+		virtual void drawFrame(render_target<T, C> &target, const rect &roi) {
+			state_cache::get().drawFullscreen();
+		}
 
-			target.init();
-			if (feedbackInput) target2.init();
+		// ends the render thread (or leaves the executor), derived classes call this in their destructor
+		void stop() {
+			if (executor) {
+				if (alive) {
+					render_ticket released(-1u);
+					executor->post([this, released]() mutable {
+						glFinish();
+						retireFrames(0);
+						releaseResources();
+						executor->_removeIdleTask(this);
+						released._complete();
+					});
+					try { released.wait(responseTimeout); }
+					catch (std::runtime_error &e) { LOG_E << "~renderer2d(): " << e.what(); }
+					alive = false;
+				}
+			} else if (renderThread.joinable()) {
+				commands.push(command(command::shutdown));
+				renderThread.join();
+			}
+		}
 
-			compileShadersOrFallback();
+	public:
+		explicit renderer2d(int width, int height, const std::string &fragShaderSrc, context &gl)
+				: fragShaderSrc(fragShaderSrc), gl(gl),
+				  alive(false), target(width, height), target2(width, height) {
+			watchedSize = sizeTag(width, height);
+		}
 
-			glActiveTexture(GL_TEXTURE0);
-			for (texture_bind &tb : inputBindings) {
-				tb.tex.init();
-			}
+		virtual ~renderer2d() {
+			stop();
+			delete completions.load();
+		}
 
-			cv.notify_one(); // init done
+		inline int width() { return target.width(); }
 
-			bool watchFragFile = watchedFragFileName.length() > 0;
-			auto tFragFileStat = std::chrono::steady_clock::now();
-			int64_t fragShaderMtime = watchFragFile ? tools::fileModTime(watchedFragFileName)													: 0;
+		inline int height() { return target.height(); }
 
-			if (watchFragFile) {
-				LOG_I << "Watching fragment shader file (" << watchedFragFileName << ")";
+		// GL calls issued by the last render, redundant state changes are skipped (see state_cache)
+		inline uint32_t glCallsLastFrame() const { return glCallsFrame; }
+
+		/*
+		 * Changes the frame size while the render thread keeps running. Frames in flight complete
+		 * first, then the program is rebuilt with the new WIDTH and HEIGHT (a cache lookup for sizes
+		 * used before) and the targets, including outputs added with addOutput(), get new storage.
+		 * Pack buffers are reused if large enough. Inputs are resized by their owner (see
+		 * texture2d::resize()). Not in streaming mode and not concurrently with other calls.
+		 */
+		void resize(int w, int h) {
+			if (isStreaming())
+				throw std::logic_error("resize(): not supported in streaming mode");
+			if (w == width() && h == height())
+				return;
+			if (!alive) {
+				checkResize(w, h);
+				resizeTargets(w, h);
+				return;
 			}
+			command cmd(command::call);
+			cmd.task = [this, w, h]() { resizeFrame(w, h); };
+			send(std::move(cmd)).wait(responseTimeout);
+		}
 
-			clear();
-
-			// make sure we dont bring any errors into the render loop
-			gl.checkAndThrowError("startBackgroundRenderThread(): post-init error state");
+		void renderThreadBody(render_ticket initDone) {
+			gl.initForThisThread();
+			initResources();
+			initDone._complete();
 
+			using namespace std::chrono_literals;
+			command cmd;
 			while (true) {
-				std::unique_lock<std::mutex> lk(mtx);
-				cv.wait(lk, [this] { return ready; });
-
-				if (!alive)
-					break;
-
-				auto now = std::chrono::steady_clock::now();
-				using namespace std::chrono_literals;
-
-				if (watchFragFile && (now - tFragFileStat) > 1s) {
-					tFragFileStat = now;
-					auto m = tools::fileModTime(watchedFragFileName);
-					if (m != fragShaderMtime) {
-						LOG_I << "Fragement shader file " << watchedFragFileName
-							  << " changed. Updating shader program...";
-						std::this_thread::sleep_for(10ms);
-						fragShaderSrc = tools::readFile(watchedFragFileName);
-						while (!compileShadersOrFallback()) {
-							std::this_thread::sleep_for(2s);
-							fragShaderSrc = tools::readFile(watchedFragFileName);
-						}
-						fragShaderMtime = m;
-						if (sw) sw->clear();
-					}
+				if (!commands.pop(cmd, inFlight.empty() ? std::chrono::nanoseconds(1s) : 200us)) {
+					// retire finished frames while idle
+					retireFrames(0, 0);
+					continue;
 				}
 
-				// render or just read
-				if (readBuffer != nullptr) {
-					getRenderTarget().read(readBuffer, width() * height() * C);
-				} else if (reader != nullptr) {
-					getRenderTarget().read(*reader, width() * height() * C);
-				} else {
-					render_internal(sw);
-				}
+				if (cmd.kind == command::shutdown)
+					break;
 
-				ready = false, rendered = true;
-				lk.unlock();
-				cv.notify_one();
+				process(cmd);
 			}
 
+			watcher.reset();
+			glFinish();
+			retireFrames(0);
 			gl.deinitForThisThread();
 			//LOG_D << "renderer2d: render thread ended";
 		}
 
 
+		/*
+		 * Starts the render thread, or with an executor (see setExecutor()) creates the renderer's GL
+		 * resources on the executor's thread.
+		 */
 		void startBackgroundRenderThread(Stopwatch *sw = nullptr) {
 			if (alive)
 				throw std::logic_error("renderer already alive");
 			alive = true;
+			this->sw = sw;
+
+			render_ticket initDone(-1u);
+			if (executor) {
+				executor->post([this, initDone]() mutable {
+					try {
+						initResources();
+						executor->_addIdleTask(this, [this]() {
+							retireFrames(0, 0);
+							return !inFlight.empty();
+						});
+						initDone._complete();
+					}
+					catch (std::runtime_error &e) {
+						LOG_E << "renderer2d: init on executor failed: " << e.what();
+						alive = false;
+						initDone._complete(e.what());
+					}
+				});
+			} else {
+				renderThread = std::thread([this, initDone]() mutable {
+					try { renderThreadBody(initDone); }
+					catch (std::runtime_error &e) {
+						LOG_E << "renderer2d: exception in render thread: " << e.what();
+						if (!initDone.done()) initDone._complete(e.what());
+					}
+					alive = false;
+				});
+			}
 
-			renderThread = std::thread([this, sw]() {
-				try { renderThreadBody(sw); }
-				catch (std::runtime_error &e) {
-					LOG_E << "renderer2d: exception in render thread: " << e.what();
-				}
-			});
+			initDone.wait(responseTimeout); // block during init
+		}
 
-			{   // block during init
-				std::unique_lock<std::mutex> lk(mtx);
-				cv.wait(lk);
-			}
+		/*
+		 * Runs this renderer on the thread and context of executor instead of an own thread.
+		 * Renderers on the same executor can use each other's output textures as input, start the
+		 * producing renderer first. The executor must outlive the renderer.
+		 */
+		void setExecutor(render_executor &e) {
+			if (alive)
+				throw std::logic_error("renderer already alive");
+			executor = &e;
 		}
 
 		void enableAccumulation(bool enable = true) {
@@ -218,11 +322,37 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			if (alive)
 				throw std::logic_error("renderer already alive");
 			inputBindings.push_back({feedbackUniformName, target2.texBuf});
-			feedbackInput = &inputBindings.back();
+			feedbackIndex = (int) inputBindings.size() - 1;
+		}
+
+		/*
+		 * Runs k feedback iterations (see enableFeedback()) on the render thread, e.g. for diffusion or
+		 * Jacobi solvers, and waits once for all of them. With checkEvery > 0, every checkEvery
+		 * iterations the largest absolute change of the output since the previous iteration is
+		 * reduced on the GPU, and the iterations stop once it is at most epsilon.
+		 * Returns the number of iterations run.
+		 */
+		int renderIterations(int k, int checkEvery = 0, float epsilon = 0.0f) {
+			if (feedbackIndex < 0)
+				throw std::logic_error("renderIterations(): feedback not enabled");
+			if (k < 0 || checkEvery < 0)
+				throw std::invalid_argument("renderIterations(): negative iteration count");
+			auto n = std::make_shared<int>(0); // outlives the caller if the wait times out
+			command cmd(command::call);
+			cmd.task = [this, k, checkEvery, epsilon, n]() {
+				while (*n < k) {
+					render_internal(sw);
+					++*n;
+					if (checkEvery > 0 && *n % checkEvery == 0 && *n < k && maxChange() <= epsilon)
+						break;
+				}
+			};
+			send(std::move(cmd)).wait(responseTimeout);
+			return *n;
 		}
 
 		render_target<T,C> &getRenderTarget(bool alt = false) {
-			return feedbackInput && (frameIndex % 2) == (alt ? 0 : 1) ? target2 : target;
+			return feedbackIndex >= 0 && (frameIndex % 2) == (alt ? 0 : 1) ? target2 : target;
 		}
 
 		texture_base &getOutputTexture(bool alt = false) {
@@ -240,6 +370,24 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			compileShaders();
 		}
 
+		/*
+		 * Adds a render target written by the shader output at the returned location
+		 * (`layout(location = N) out ...`), next to the main output at location 0. Outputs can have
+		 * their own type and channel count but must match the frame size. They are read back with
+		 * getResult(out, ...) or bound as input of renderers on the same executor.
+		 */
+		template<typename U, int K>
+		int addOutput(render_target<U, K> &out) {
+			if (alive)
+				throw std::logic_error("cannot add output, renderer already alive");
+			if (out.width() != width() || out.height() != height())
+				throw std::invalid_argument("addOutput(): output size differs from the frame size");
+			extraOutputs.push_back({out.texBuf, [&out]() { out.init(), out.clear(); }, [&out]() { out.deinit(); },
+									[&out](int w, int h) { out.resize(w, h); },
+									[&out](int w, int h) { out.checkResize(w, h); }});
+			return (int) extraOutputs.size();
+		}
+
 		void addInput(const std::string &name, texture_base &tex) {
 			if (alive)
 				throw std::logic_error("cannot add input texture, renderer already alive");
@@ -247,21 +395,196 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			inputBindings.push_back({name, tex});
 		}
 
+		/*
+		 * Leases the upload memory of input tex for the next frame from any thread (see
+		 * texture_pbo::beginWrite()): fill lease.data() and pass it to tex.commit() before the render.
+		 */
+		template<typename U, int K>
+		typename texture_pbo<U, K>::lease beginWrite(texture_pbo<U, K> &tex) {
+			// shared with the task, which may run after the caller gave up waiting
+			struct result {
+				std::mutex mutex;
+				typename texture_pbo<U, K>::lease l;
+				bool abandoned = false;
+			};
+			auto r = std::make_shared<result>();
+			command cmd(command::call);
+			cmd.task = [&tex, r]() {
+				std::lock_guard<std::mutex> lock(r->mutex);
+				if (!r->abandoned) r->l = tex.beginWrite();
+			};
+			try { send(std::move(cmd)).wait(responseTimeout); }
+			catch (std::runtime_error &) {
+				std::lock_guard<std::mutex> lock(r->mutex);
+				r->abandoned = true;
+				if (r->l) { // mapped after all, hand it back so later leases work
+					command release(command::call);
+					release.task = [&tex, r]() { tex.discard(r->l); };
+					send(std::move(release));
+				}
+				throw;
+			}
+			return r->l;
+		}
+
 		void render() {
-			readBuffer = 0;
-			notifyRenderThread();
+			send(command(command::render)).wait(responseTimeout);
+		}
+
+		/*
+		 * Renders only the pixels in roi (with glScissor), the rest of the output keeps its content.
+		 */
+		void render(const rect &roi) {
+			checkRoi(roi);
+			command cmd(command::render);
+			cmd.roi = roi;
+			send(std::move(cmd)).wait(responseTimeout);
 		}
 
+		/*
+		 * Renders a frame without waiting for the GPU. Returns as soon as the render thread issued
+		 * the frame's commands, so the caller can prepare the next frame (e.g. upload inputs) while
+		 * this one is still on the GPU. At most maxFramesInFlight frames are pending, further
+		 * submissions block until the oldest one completed.
+		 */
+		render_ticket submit() {
+			return submit(nullptr);
+		}
+
+		/*
+		 * As submit(), but also downloads the frame into dst through the render target's readback ring.
+		 * The download overlaps with rendering of the following frames, the ticket completes once dst
+		 * is filled. dst must hold width() * height() * C elements and stay valid until then.
+		 */
+		render_ticket submit(T *dst) {
+			command cmd(command::submit, dst);
+			auto frame = cmd.frame = render_ticket(-1u);
+			send(std::move(cmd)).wait(responseTimeout);
+			return frame;
+		}
+
+		render_ticket submit(HlBuf<T> &buffer) {
+			if (buffer.number_of_elements() != width() * height() * C)
+				throw std::runtime_error("submit(): invalid buffer size");
+			return submit(buffer.begin());
+		}
+
+		/*
+		 * Sets the number of pack buffers used for overlapped downloads (see submit(T*))
+		 */
+		void setReadbackRingSize(int k) {
+			if (alive)
+				throw std::logic_error("renderer already alive");
+			target.setReadbackRingSize(k), target2.setReadbackRingSize(k);
+		}
+
+		void setMaxFramesInFlight(int n) {
+			if (n < 1)
+				throw std::invalid_argument("setMaxFramesInFlight(): need at least 1 frame");
+			maxFramesInFlight = n;
+		}
+
+		/*
+		 * Time callers wait for the render thread to process a command before giving up (default 4s)
+		 */
+		void setResponseTimeout(std::chrono::milliseconds timeout) { responseTimeout = timeout; }
+
 		void getResult(T *buffer) {
-			readBuffer = buffer;
-			notifyRenderThread();
-			readBuffer = nullptr;
+			send(command(command::read, buffer)).wait(responseTimeout);
 		}
 
 		void getResult(std::function<void(const T *src)> &read) {
-			reader = &read;
-			notifyRenderThread();
-			reader = nullptr;
+			command cmd(command::read_fn);
+			cmd.reader = &read;
+			send(std::move(cmd)).wait(responseTimeout);
+		}
+
+		/*
+		 * Reads a half float frame into float dst. Half the bytes of a float target are downloaded,
+		 * the conversion (see half.h) runs on the mapped pack buffer.
+		 */
+		template<typename U = T, typename = typename std::enable_if<std::is_same<U, float16_t>::value>::type>
+		void getResult(float *dst) {
+			size_t n = (size_t) width() * height() * C;
+			std::function<void(const T *src)> read = [dst, n](const T *src) { half::toFloat(src, dst, n); };
+			getResult(read);
+		}
+
+		template<typename U = T, typename = typename std::enable_if<std::is_same<U, float16_t>::value>::type>
+		void getResult(HlBuf<float> &buffer) {
+			if (buffer.number_of_elements() != width() * height() * C)
+				throw std::runtime_error("getResult(): invalid buffer size");
+			getResult(buffer.begin());
+		}
+
+		/*
+		 * Queues update(program) to run on the render thread with the shader program bound, before any
+		 * render queued afterwards. Returns without waiting, the ticket completes once update ran.
+		 */
+		render_ticket updateUniforms(std::function<void(GLuint program)> update) {
+			command cmd(command::update_uniforms);
+			cmd.update = std::move(update);
+			return send(std::move(cmd));
+		}
+
+		/*
+		 * Sets a shader parameter from any thread, applied before the next frame without recompiling.
+		 * Members of uniform blocks (`layout(std140) uniform params { float gain; };`) are batched
+		 * into one buffer update per block and frame. See uniform_params for names and conversions.
+		 */
+		void setUniform(const std::string &name, float v) { params.set(name, GL_FLOAT, &v, 1); }
+
+		void setUniform(const std::string &name, double v) { setUniform(name, (float) v); }
+
+		void setUniform(const std::string &name, int32_t v) { params.set(name, GL_INT, &v, 1); }
+
+		void setUniform(const std::string &name, uint32_t v) { params.set(name, GL_UNSIGNED_INT, &v, 1); }
+
+		// vectors, matrices (column-major) and arrays as flat lists of components
+		void setUniform(const std::string &name, std::initializer_list<float> v) {
+			params.set(name, GL_FLOAT, v.begin(), v.size());
+		}
+
+		template<typename V>
+		void setUniform(const std::string &name, const V *v, size_t n) {
+			static_assert(std::is_same<V, float>::value || std::is_same<V, int32_t>::value ||
+						  std::is_same<V, uint32_t>::value, "setUniform(): float, int32_t or uint32_t components");
+			params.set(name, std::is_same<V, float>::value ? GL_FLOAT :
+							 std::is_same<V, int32_t>::value ? GL_INT : GL_UNSIGNED_INT, v, n);
+		}
+
+		template<typename V>
+		void setUniform(const std::string &name, const std::vector<V> &v) {
+			setUniform(name, v.data(), v.size());
+		}
+
+		/*
+		 * Reads the pixels in roi into dst, with rows dstStride pixels apart (0 for roi.width).
+		 * Only the rectangle is read and copied.
+		 */
+		void getResult(const rect &roi, T *dst, int dstStride = 0) {
+			checkRoi(roi);
+			command cmd(command::read, dst);
+			cmd.roi = roi, cmd.dstStride = dstStride;
+			send(std::move(cmd)).wait(responseTimeout);
+		}
+
+		// reads an output added with addOutput()
+		template<typename U, int K>
+		void getResult(render_target<U, K> &out, U *dst) {
+			command cmd(command::call);
+			cmd.task = [this, &out, dst]() {
+				retireFrames(0);
+				out.read(dst, out.width() * out.height() * K);
+			};
+			send(std::move(cmd)).wait(responseTimeout);
+		}
+
+		template<typename U, int K>
+		void getResult(render_target<U, K> &out, HlBuf<U> &buffer) {
+			if (buffer.number_of_elements() != out.width() * out.height() * K)
+				throw std::runtime_error("getResult(): invalid buffer size");
+			getResult(out, buffer.begin());
 		}
 
 		void getResult(HlBuf<T> &buffer) {
@@ -270,6 +593,100 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			getResult(buffer.begin());
 		}
 
+		/*
+		 * Enables streaming mode with input as the streamed texture, e.g. for a live preview where only
+		 * the newest frame matters. Frames published with publishFrame() go through a triple buffer
+		 * and are rendered and read back on the render thread as they arrive, without round trips.
+		 * A frame published before the render thread took the previous one replaces it (counted in
+		 * droppedFrames()), so latency stays bounded under bursts. Use before the renderer starts,
+		 * input must be one of its inputs.
+		 */
+		template<typename U, int K>
+		void enableStreaming(texture2d<U, K> &input) {
+			if (alive)
+				throw std::logic_error("renderer already alive");
+			if (input.width != width() || input.height != height())
+				throw std::invalid_argument("enableStreaming(): input size differs from the frame size");
+			size_t n = (size_t) width() * height() * K;
+			streamIn.reset(new triple_buffer<uint8_t>(sizeof(U) * n));
+			streamOut.reset(new triple_buffer<T>((size_t) width() * height() * C));
+			streamUpload = [&input, n](const uint8_t *frame) {
+				input.upload(reinterpret_cast<const U *>(frame), n);
+			};
+		}
+
+		inline bool isStreaming() const { return streamIn != nullptr; }
+
+		/*
+		 * Publishes the next input frame of the stream and returns without waiting. data is copied.
+		 * Only one thread may publish.
+		 */
+		template<typename U>
+		void publishFrame(const U *data, size_t n) {
+			if (!streamIn)
+				throw std::logic_error("publishFrame(): streaming not enabled");
+			if (sizeof(U) * n != streamIn->size())
+				throw std::runtime_error("publishFrame(): invalid frame size");
+			memcpy(streamIn->writeBuffer(), data, streamIn->size());
+			if (!streamIn->publish())
+				++nDropped;
+			if (!streamKick.exchange(true))
+				send(command(command::stream));
+		}
+
+		template<typename U>
+		inline void publishFrame(const HlBuf<U> &buf) {
+			publishFrame(buf.begin(), buf.number_of_elements());
+		}
+
+		/*
+		 * Copies the latest streamed output into dst, if there is one newer than the last one taken.
+		 * Never blocks. Only one thread may take results.
+		 */
+		bool getLatestResult(T *dst) {
+			if (!streamOut)
+				throw std::logic_error("getLatestResult(): streaming not enabled");
+			if (!streamOut->acquire())
+				return false;
+			memcpy(dst, streamOut->readBuffer(), sizeof(T) * streamOut->size());
+			return true;
+		}
+
+		bool getLatestResult(HlBuf<T> &buffer) {
+			if (buffer.number_of_elements() != width() * height() * C)
+				throw std::runtime_error("getLatestResult(): invalid buffer size");
+			return getLatestResult(buffer.begin());
+		}
+
+		// stream frames rendered and replaced before they were rendered
+		inline uint64_t streamedFrames() const { return nStreamed; }
+
+		inline uint64_t droppedFrames() const { return nDropped; }
+
+		/*
+		 * Returns a file descriptor (eventfd) that becomes readable when submitted frames complete,
+		 * for hosts driving many renderers from one epoll loop. Call drainCompletions() once it is
+		 * readable and check the frames' tickets with render_ticket::poll(). Linux and Android only.
+		 */
+		int getCompletionFd() {
+			event_fd *e = completions.load();
+			if (!e) {
+				auto *created = new event_fd();
+				if (completions.compare_exchange_strong(e, created)) e = created;
+				else delete created;
+			}
+			return e->get();
+		}
+
+		/*
+		 * Returns the number of frames completed since the last call and makes the completion fd
+		 * unreadable until the next one completes. Never blocks.
+		 */
+		uint64_t drainCompletions() {
+			event_fd *e = completions.load();
+			return e ? e->drain() : 0;
+		}
+
 		inline bool isAlive() { return alive; }
 
 		void setExternalTextureUpdateCallback(std::function<void(void)> &callback) {
@@ -278,29 +695,34 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 
 	private:
 
+		bool isSampler(const std::string &uName) {
+			const char *name = uName.c_str();
+			GLuint index = GL_INVALID_INDEX;
+			GLint type = 0;
+			glGetUniformIndices(prog, 1, &name, &index);
+			if (index == GL_INVALID_INDEX)
+				return false;
+			glGetActiveUniformsiv(prog, 1, &index, GL_UNIFORM_TYPE, &type);
+			switch (type) {
+				case GL_SAMPLER_2D: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+				case GL_SAMPLER_2D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+				case GL_SAMPLER_3D: case GL_INT_SAMPLER_3D: case GL_UNSIGNED_INT_SAMPLER_3D:
+				case GL_SAMPLER_CUBE: case GL_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_CUBE:
+				case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+				case GL_SAMPLER_EXTERNAL_OES:
+					return true;
+				default:
+					return false;
+			}
+		}
+
 		bool compileShadersOrFallback() {
 			try {
 				for (texture_bind &tb : inputBindings)
 					tb.uLoc = -1;
 
 				compileShaders();
-
-				bool allFound = true;
-				for (texture_bind &ib : inputBindings) {
-					ib.uLoc = glGetUniformLocation(prog, ib.uName.c_str());
-					gl.checkAndThrowError("glGetUniformLocation " + ib.uName);
-					if (ib.uLoc == -1) {
-						LOG_W << "shader uniform " << ib.uName
-							  << " not found/optimized out, ignore";
-						allFound = false;
-						if (feedbackInput && &ib == feedbackInput)
-							throw std::runtime_error(
-									"feedback uniform " + ib.uName + " optimized out");
-					}
-				}
-				if (allFound) {
-					LOG_V << "All " << inputBindings.size() << " textures bound to uniforms";
-				}
+				lookupInputs();
 				return true;
 			}
 			catch (std::runtime_error &ex) {
@@ -313,113 +735,419 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			}
 		}
 
-		void notifyRenderThread() {
+		// swaps in a program the watcher built, between frames
+		void swapProgram(shader_watcher::program rebuilt) {
+			GLuint newProg = rebuilt.id;
+			if (rebuilt.tag != watchedSize) {
+				LOG_W << "Rebuilt shader program of " << watchedFragFileName << " is for an old frame size, discarded";
+				glDeleteProgram(newProg);
+				return;
+			}
+			GLuint oldProg = prog;
+			prog = newProg;
+			try { lookupInputs(); }
+			catch (std::runtime_error &e) {
+				LOG_E << "Rebuilt shader program unusable, keeping the current one: " << e.what();
+				prog = oldProg, lookupInputs();
+				glDeleteProgram(newProg);
+				return;
+			}
+			state_cache::get().forgetProgram(oldProg), glDeleteProgram(oldProg);
+			++progGeneration;
+			usingFallbackFragment = false;
+			LOG_I << "Swapped in the rebuilt shader program of " << watchedFragFileName;
+			if (sw) sw->clear();
+		}
+
+		// on the render thread, see resize()
+		void resizeFrame(int w, int h) {
+			glFinish();
+			retireFrames(0);
+
+			// check and build first, so a failure leaves the renderer as it was
+			checkResize(w, h);
+			checkLimits(w, h);
+			std::string src = watchedFragFileName.empty() ? fragShaderSrc : tools::readFile(watchedFragFileName);
+			GLuint newProg = buildProgram(src, w, h);
+
+			auto resizeAttached = [this](int w, int h) {
+				resizeTargets(w, h);
+				if (!extraOutputs.empty()) {
+					attachOutputs(target);
+					if (feedbackIndex >= 0) attachOutputs(target2);
+				}
+			};
+			int oldW = width(), oldH = height();
+			try { resizeAttached(w, h); }
+			catch (std::exception &e) {
+				LOG_E << "renderer2d: resize to " << w << "x" << h << " failed, back to " << oldW << "x" << oldH
+					  << ": " << e.what();
+				glDeleteProgram(newProg);
+				resizeAttached(oldW, oldH);
+				throw;
+			}
+
+			state_cache::get().forgetProgram(prog), glDeleteProgram(prog);
+			prog = newProg, ++progGeneration;
+			usingFallbackFragment = false;
+			lookupInputs();
+			if (changeReduction) changeReduction->deinit(), changeReduction.reset();
+
+			if (feedbackIndex >= 0)
+				getRenderTarget(true).clear();
+			gl.checkAndThrowError("resize()");
+			LOG_I << "renderer2d: resized to " << w << "x" << h;
+		}
+
+		// throws if the targets cannot take the size, before any of them changes
+		void checkResize(int w, int h) {
+			if (w <= 0 || h <= 0)
+				throw std::invalid_argument("resize(): invalid size " + std::to_string(w) + "x" + std::to_string(h));
+			target.checkResize(w, h);
+			target2.checkResize(w, h);
+			for (auto &o : extraOutputs)
+				o.checkResize(w, h);
+		}
+
+		// throws if the GL limits cannot hold a frame of w x h, before anything is allocated
+		void checkLimits(int w, int h) {
+			GLint maxTex = 0, maxViewport[2] = {0, 0};
+			glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTex);
+			glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewport);
+			if (w > maxTex || h > maxTex || w > maxViewport[0] || h > maxViewport[1])
+				throw std::runtime_error("renderer2d: frame size " + std::to_string(w) + "x" + std::to_string(h) +
+										 " exceeds the GL limits (texture " + std::to_string(maxTex) + ", viewport " +
+										 std::to_string(maxViewport[0]) + "x" + std::to_string(maxViewport[1]) + ")");
+		}
+
+		void resizeTargets(int w, int h) {
+			target.resize(w, h);
+			target2.resize(w, h);
+			for (auto &o : extraOutputs)
+				o.resize(w, h);
+			watchedSize = sizeTag(w, h);
+		}
+
+		// the frame size in one word, read by the watcher thread while the render thread resizes
+		static uint64_t sizeTag(int w, int h) {
+			return (uint64_t) (uint32_t) w << 32 | (uint32_t) h;
+		}
+
+		// finds the sampler uniforms of the inputs in the program
+		void lookupInputs() {
+			bool allFound = true;
+			for (texture_bind &ib : inputBindings) {
+				ib.uLoc = glGetUniformLocation(prog, ib.uName.c_str());
+				gl.checkAndThrowError("glGetUniformLocation " + ib.uName);
+				if (ib.uLoc != -1 && !isSampler(ib.uName)) {
+					// e.g. an image of a compute shader, bound by the derived class
+					LOG_V << "shader uniform " << ib.uName << " is not a sampler, not bound to a unit";
+					ib.uLoc = -1;
+					continue;
+				}
+				if (ib.uLoc == -1) {
+					LOG_W << "shader uniform " << ib.uName
+						  << " not found/optimized out, ignore";
+					allFound = false;
+					if (isFeedback(ib))
+						throw std::runtime_error(
+								"feedback uniform " + ib.uName + " optimized out");
+				}
+			}
+			if (allFound) {
+				LOG_V << "All " << inputBindings.size() << " textures bound to uniforms";
+			}
+		}
+
+		/*
+		 * Completes tickets of frames the GPU finished until at most maxPending frames remain in flight.
+		 * Waits up to timeoutNs for each frame beyond maxPending, then stops at the first pending one.
+		 */
+		void retireFrames(size_t maxPending, uint64_t timeoutNs = GL_TIMEOUT_IGNORED) {
+			while (!inFlight.empty()) {
+				auto &f(inFlight.front());
+				if (!f.done.wait(inFlight.size() > maxPending ? timeoutNs : 0))
+					break;
+
+				std::string error;
+				if (f.readTarget) {
+					T *dst = f.streamed ? streamOut->writeBuffer() : f.dst;
+					size_t nBytes = sizeof(T) * C * width() * height();
+					std::function<void(const T *src)> copy = [dst, nBytes](const T *src) {
+						memcpy(dst, src, nBytes);
+					};
+					try {
+						f.readTarget->finishRead(f.readSlot, copy);
+						if (f.streamed) streamOut->publish();
+					}
+					catch (std::runtime_error &e) { error = e.what(); }
+				}
+				completeFrame(f.ticket, error);
+				inFlight.pop_front();
+			}
+		}
+
+		void completeFrame(render_ticket &ticket, const std::string &error) {
+			if (ticket.valid())
+				ticket._complete(error);
+			if (event_fd *e = completions.load())
+				e->notify();
+		}
+
+		/*
+		 * Queues a command for the render thread, safe to call from any number of threads.
+		 * Returns the ticket completed after the command ran.
+		 */
+		render_ticket send(command &&cmd) {
 			if (!alive)
 				throw std::logic_error("renderer is not alive");
+			auto done = cmd.done = render_ticket(-1u);
+			if (executor)
+				executor->post([this, cmd]() mutable { process(cmd); });
+			else
+				commands.push(std::move(cmd));
+			return done;
+		}
+
+		// creates the GL resources on the current context
+		void initResources() {
+			checkLimits(width(), height());
+			target.init();
+			if (feedbackIndex >= 0) target2.init();
 
-			{
-				std::lock_guard<std::mutex> lk(mtx);
-				rendered = false;
-				ready = true;
+			if (!extraOutputs.empty()) {
+				for (auto &o : extraOutputs)
+					o.init();
+				attachOutputs(target);
+				if (feedbackIndex >= 0) attachOutputs(target2);
 			}
-			cv.notify_one();
-			{
-				using namespace std::chrono_literals;
-				std::unique_lock<std::mutex> lk(mtx);
-				if (!cv.wait_for(lk, 4s, [this] { return rendered; })) {
-					LOG_E << "Timed out waiting for render thread after 4s";
-					throw std::runtime_error("render thread not responding");
-				}
+
+			compileShadersOrFallback();
+
+			glActiveTexture(GL_TEXTURE0);
+			for (texture_bind &tb : inputBindings) {
+				if (isFeedback(tb))
+					continue; // a render target
+				// on an executor, inputs might already live on its context (e.g. outputs of other renderers)
+				if (executor) tb.tex.maybeInit();
+				else tb.tex.init();
+			}
+
+			if (!watchedFragFileName.empty()) {
+				watcher.reset(new shader_watcher(watchedFragFileName, [this](const std::string &src) {
+					uint64_t size = watchedSize;
+					GLuint p = buildProgram(src, (int) (size >> 32), (int) (uint32_t) size);
+					return shader_watcher::program{p, size};
+				}));
+				LOG_I << "Watching fragment shader file (" << watchedFragFileName << ")";
+			}
+
+			glDisable(GL_CULL_FACE);
+			glDisable(GL_DEPTH_TEST);
+			state_cache::get().invalidate();
+
+			clear();
+			if (feedbackIndex >= 0)
+				getRenderTarget(true).clear(); // the first iteration reads zeros
+
+			// make sure we dont bring any errors into the render loop
+			gl.checkAndThrowError("startBackgroundRenderThread(): post-init error state");
+		}
+
+		// deletes the GL objects owned by the renderer, needed if the context outlives it
+		void releaseResources() {
+			watcher.reset();
+			if (prog != 0) state_cache::get().forgetProgram(prog), glDeleteProgram(prog), prog = 0;
+			target.deinit();
+			target2.deinit();
+			for (auto &o : extraOutputs)
+				o.deinit();
+			if (changeReduction) changeReduction->deinit(), changeReduction.reset();
+			params.release();
+		}
+
+		inline bool isFeedback(const texture_bind &tb) const {
+			return feedbackIndex >= 0 && &tb == &inputBindings[feedbackIndex];
+		}
+
+		// largest absolute change of the output in the last feedback iteration, reduced on the GPU
+		float maxChange() {
+			if (!changeReduction) {
+				changeReduction.reset(new max_abs_diff<T, C>(width(), height()));
+				changeReduction->init(gl);
+			}
+			float d = changeReduction->run(target.texBuf, target2.texBuf);
+			LOG_V << "renderer2d(frame=" << frameIndex << "): max change " << d;
+			return d;
+		}
+
+		// attaches the extra outputs to the framebuffer of t and enables them as draw buffers
+		void attachOutputs(render_target<T, C> &t) {
+			GLint maxDrawBuffers = 0;
+			glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
+			if ((int) extraOutputs.size() + 1 > maxDrawBuffers)
+				throw std::runtime_error("renderer2d: more outputs than GL_MAX_DRAW_BUFFERS ("
+										 + std::to_string(maxDrawBuffers) + ")");
+
+			std::vector<GLenum> drawBuffers{GL_COLOR_ATTACHMENT0};
+			for (auto &o : extraOutputs) {
+				GLenum attachment = GL_COLOR_ATTACHMENT0 + (GLenum) drawBuffers.size();
+				t.bind();
+				glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, o.tex.getGlTarget(), o.tex.getGlId(), 0);
+				gl.checkAndThrowError("renderer2d: attach output", o.tex);
+				drawBuffers.push_back(attachment);
 			}
+			glDrawBuffers((GLsizei) drawBuffers.size(), drawBuffers.data());
+			gl.checkAndThrowError("renderer2d: glDrawBuffers");
 		}
 
+		// runs a command on the render thread and completes its tickets
+		void process(command &cmd) {
+			if (watcher) {
+				auto rebuilt = watcher->take();
+				if (rebuilt.id) swapProgram(rebuilt);
+			}
+
+			std::string error;
+			try {
+				execute(cmd, sw);
+			}
+			catch (std::exception &e) {
+				LOG_E << "renderer2d: command " << cmd.kind << " failed: " << e.what();
+				error = e.what();
+				if (cmd.frame.valid() && !cmd.frame.done())
+					completeFrame(cmd.frame, error);
+			}
+			cmd.done._complete(error);
+		}
+
+		// runs on the render thread
+		void execute(command &cmd, Stopwatch *sw) {
+			switch (cmd.kind) {
+				case command::read:
+					retireFrames(0);
+					if (cmd.roi.empty())
+						getRenderTarget().read(cmd.dst, width() * height() * C);
+					else
+						getRenderTarget().read(cmd.roi, cmd.dst, cmd.dstStride);
+					break;
+
+				case command::read_fn:
+					retireFrames(0);
+					getRenderTarget().read(*cmd.reader, width() * height() * C);
+					break;
+
+				case command::call:
+					cmd.task();
+					break;
+
+				case command::update_uniforms:
+					state_cache::get().useProgram(prog);
+					cmd.update(prog);
+					gl.checkAndThrowError("updateUniforms()");
+					break;
+
+				case command::submit:
+					submitFrame(cmd, false);
+					break;
+
+				case command::stream:
+					streamKick = false; // publishers kick again from now on
+					if (!streamIn->acquire())
+						break; // already rendered with an earlier kick
+					streamUpload(streamIn->readBuffer());
+					submitFrame(cmd, true);
+					++nStreamed;
+					break;
+
+				default:
+					render_internal(sw, cmd.roi);
+			}
+		}
+
+
+		// renders a frame and queues its readback, completed by retireFrames()
+		void submitFrame(command &cmd, bool streamed) {
+			retireFrames(maxFramesInFlight - 1);
+			render_internal(sw);
+
+			if (cmd.frame.valid()) cmd.frame._setFrameIndex(frameIndex);
+			frame_in_flight f{fence(), cmd.frame};
+			if (cmd.dst != nullptr || streamed) {
+				auto &target(getRenderTarget());
+				while (target.readRingFull())
+					retireFrames(inFlight.size() - 1);
+				f.readTarget = &target, f.readSlot = target.readAsync(), f.dst = cmd.dst;
+				f.streamed = streamed;
+			}
+			f.done.insert();
+			inFlight.push_back(std::move(f));
+		}
 
 		void clear() {
 			auto &target(getRenderTarget(false));
 			target.clear();
 		}
 
-		void render_internal(Stopwatch *sw) {
+		void checkRoi(const rect &roi) {
+			if (roi.empty() || !roi.inside(width(), height()))
+				throw std::runtime_error("renderer2d: roi outside of the frame");
+		}
+
+		void render_internal(Stopwatch *sw, const rect &roi = rect{0, 0, 0, 0}) {
 			if (sw) sw->start();
-			const float l = -1.0f, r = 1.0f;
-			static khronos_float_t vPositions[] = {
-					l, l, r, l, r, r,
-					r, r, l, r, l, l
-			};
 
 			if (eglGetCurrentContext() == EGL_NO_CONTEXT)
 				throw std::runtime_error("no EGL context");
 
 			++frameIndex;
+			auto &state(state_cache::get());
+			uint32_t callsBefore = state.callCount();
 
-			unsigned int vertexPosBuffer;
-			glGenBuffers(1, &vertexPosBuffer);
-			glBindBuffer(GL_ARRAY_BUFFER, vertexPosBuffer);
-			glBufferData(GL_ARRAY_BUFFER, sizeof(vPositions), vPositions, GL_STATIC_DRAW);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-			glUseProgram(prog);
-
-			glEnableVertexAttribArray(0);
-			glBindBuffer(GL_ARRAY_BUFFER, vertexPosBuffer);
-			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
-			glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-			if (sw) sw->measure("glVBuf");
-
-			if (feedbackInput) {
-				feedbackInput->tex = getOutputTexture(true);
-				LOG_I << "gl::renderer2d(frame=" << frameIndex << "): feedback input is "
-					  << feedbackInput->tex.to_string();
-			}
+			state.useProgram(prog);
 
 			if (updateTexturesExternal) {
 				updateTexturesExternal();
+				state.invalidate();
+				state.useProgram(prog);
 				if (sw) sw->measure("updateTexturesExternal");
 			}
 
-			gl.checkAndThrowError("render(): texture_bind");
+			params.apply(prog, progGeneration);
 
-
-			gl.checkAndThrowError("render(): glBindFramebuffer");
 			auto &target(getRenderTarget(false));
 
-			glDisable(GL_CULL_FACE);
-			glDisable(GL_DEPTH_TEST);
-
 			if (accumulate) {
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_ONE, GL_ONE);
-				glBlendEquation(GL_FUNC_ADD);
-				gl.checkAndThrowError("render(): glBlend*");
+				state.blend(true);
+				state.blendFunc(GL_ONE, GL_ONE, GL_FUNC_ADD);
 
 				if (frameIndex == 0) {
 					clear();
 				}
 			} else {
-				glDisable(GL_BLEND);
+				state.blend(false);
 			}
 
 			// attach the output texture
 			target.bind(true);
 			if (sw) sw->measure("glFBO");
 
-
-			glViewport(0, 0, target.width(), target.height());
+			state.viewport(0, 0, target.width(), target.height());
+			state.scissor(roi);
 			if (sw) sw->measure("glPrep");
 
 			int i = 0;
 			for (texture_bind &tb : inputBindings) {
 				if (tb.uLoc == -1)
 					continue;
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(tb.tex.getGlTarget(), tb.tex.getGlId());
-				tb.tex._preRender();
-				gl.checkAndThrowError("render(): glBindTexture", tb.tex);
-
-				glUniform1i(tb.uLoc, i);
-				LOG_V << "bound texture " << tb.tex.to_string() << " to uniform " << tb.uName
-					  << " (unit GL_TEXTURE" << i << ", target " << tb.tex.getGlTargetString()
+				// the feedback input alternates between the targets
+				texture_base &tex(isFeedback(tb) ? getOutputTexture(true) : tb.tex);
+				state.bindTexture(i, tex.getGlTarget(), tex.getGlId());
+				state.activeTexture(i); // uploads in _preRender() go to the active unit
+				tex._preRender();
+				state.uniform1i(tb.uLoc, i);
+				LOG_V << "bound texture " << tex.to_string() << " to uniform " << tb.uName
+					  << " (unit GL_TEXTURE" << i << ", target " << tex.getGlTargetString()
 					  << ")";
 				++i;
 
@@ -427,7 +1155,10 @@ color = vec4((pos.x == pos.y) ? 200 : 0, 0,0, (pos.x == (size.y-pos.y)) ? 200 :
 			}
 			if (sw) sw->measure("texBind");
 
-			glDrawArrays(GL_TRIANGLES, 0, 6);
+			drawFrame(target, roi);
+			gl.checkAndThrowError("render(): draw");
+			state.count(); // glGetError
+			glCallsFrame = state.callCount() - callsBefore;
 			if (sw) sw->measure("glDrawArrays");
 		}
 	};
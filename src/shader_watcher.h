@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "event_fd.h"
+#include "render_ticket.h"
+#include "shared_context.h"
+#include "tools.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace gl {
+
+	/*
+	 * Watches a shader file on a helper thread (inotify on Linux, mtime polling elsewhere) and builds
+	 * a new program from it on a shared context whenever it changes, so editing shaders does not
+	 * stall the render thread. The render thread picks finished programs up with take() between
+	 * frames. Programs that fail to build are logged and skipped.
+	 */
+	class shader_watcher {
+	public:
+		struct program {
+			GLuint id = 0;
+			uint64_t tag = 0; // set by the builder, e.g. the frame size the program was built for
+		};
+
+	private:
+		std::string fileName;
+		std::function<program(const std::string &src)> build; // on the helper thread
+		shared_context ctx;
+		std::thread thread;
+		std::mutex pendingMutex;
+		program pending;
+		std::atomic<bool> running{true};
+#if defined(__linux__)
+		event_fd stopSignal;
+#endif
+
+	public:
+		// on the render thread, with its context current
+		shader_watcher(const std::string &fileName, std::function<program(const std::string &src)> build)
+				: fileName(fileName), build(std::move(build)) {
+			render_ticket started(-1u);
+			thread = std::thread([this, started]() mutable { run(started); });
+			try { started.wait(); }
+			catch (std::runtime_error &) {
+				thread.join();
+				throw;
+			}
+		}
+
+		shader_watcher(const shader_watcher &) = delete;
+
+		~shader_watcher() {
+			running = false;
+#if defined(__linux__)
+			stopSignal.notify();
+#endif
+			thread.join();
+		}
+
+		// returns the latest program built since the last call (the caller owns it), or one with id 0
+		inline program take() { return exchange({}); }
+
+	private:
+		void run(render_ticket started) {
+			try { ctx.makeCurrent(); }
+			catch (std::runtime_error &e) {
+				LOG_E << "shader_watcher: " << e.what();
+				started._complete(e.what());
+				return;
+			}
+
+#if defined(__linux__)
+			// watch the directory, editors often replace files instead of writing them
+			auto slash = fileName.rfind('/');
+			std::string dir = slash == std::string::npos ? "." : fileName.substr(0, slash + 1);
+			std::string base = slash == std::string::npos ? fileName : fileName.substr(slash + 1);
+			int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (fd == -1 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+				std::string error = std::string("inotify failed: ") + strerror(errno);
+				LOG_E << "shader_watcher: " << error;
+				if (fd != -1) close(fd);
+				ctx.release();
+				started._complete(error);
+				return;
+			}
+			started._complete();
+
+			pollfd fds[2] = {{fd, POLLIN, 0}, {stopSignal.get(), POLLIN, 0}};
+			while (running) {
+				if (poll(fds, 2, -1) <= 0 || (fds[1].revents & POLLIN))
+					continue;
+				bool changed = readEvents(fd, base);
+				// let bursts of writes settle
+				while (running && poll(fds, 1, 30) > 0)
+					changed |= readEvents(fd, base);
+				if (changed && running)
+					rebuild();
+			}
+			close(fd);
+#else
+			started._complete();
+			int64_t mtime = tools::fileModTime(fileName);
+			while (running) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(200));
+				auto m = tools::fileModTime(fileName);
+				if (m != mtime) mtime = m, rebuild();
+			}
+#endif
+
+			program left = exchange({});
+			if (left.id) glDeleteProgram(left.id);
+			ctx.release();
+		}
+
+		program exchange(program p) {
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			std::swap(p, pending);
+			return p;
+		}
+
+#if defined(__linux__)
+		// returns whether any of the queued events is about the watched file
+		static bool readEvents(int fd, const std::string &base) {
+			alignas(inotify_event) char buf[4096];
+			bool hit = false;
+			ssize_t n;
+			while ((n = read(fd, buf, sizeof(buf))) > 0) {
+				for (char *p = buf; p < buf + n;) {
+					auto *e = reinterpret_cast<inotify_event *>(p);
+					if (e->len > 0 && base == e->name) hit = true;
+					p += sizeof(inotify_event) + e->len;
+				}
+			}
+			return hit;
+		}
+#endif
+
+		void rebuild() {
+			LOG_I << "Shader file " << fileName << " changed, building in the background...";
+			std::string src = tools::readFile(fileName);
+			if (src.empty())
+				return; // truncated by the editor, the write follows
+			try {
+				program p = build(src);
+				glFinish(); // complete before the render thread uses it
+				program old = exchange(p);
+				if (old.id) glDeleteProgram(old.id); // never taken
+			}
+			catch (std::runtime_error &e) {
+				LOG_E << "Failed to build " << fileName << ", keeping the current program: " << e.what();
+				while (glGetError() != GL_NO_ERROR);
+			}
+		}
+	};
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "context.h"
+
+namespace gl {
+
+	/*
+	 * An EGL context in the share group of the context current on the creating thread, for helper
+	 * threads (e.g. compiling shaders in the background). Programs, textures and buffers created on
+	 * it are usable on the other context once the helper finished them (glFinish() or a fence).
+	 */
+	class shared_context {
+		EGLDisplay display = EGL_NO_DISPLAY;
+		EGLConfig config = nullptr;
+		EGLContext share = EGL_NO_CONTEXT, ctx = EGL_NO_CONTEXT;
+		EGLSurface surface = EGL_NO_SURFACE;
+		GLint major = 3, minor = 0; // version of the shared context, e.g. 3.1 for compute shaders
+
+	public:
+		// on the thread owning the context to share with
+		shared_context() {
+			display = eglGetCurrentDisplay();
+			share = eglGetCurrentContext();
+			if (share == EGL_NO_CONTEXT)
+				throw std::runtime_error("shared_context: no current EGL context");
+
+			EGLint configId = 0, n = 0;
+			eglQueryContext(display, share, EGL_CONFIG_ID, &configId);
+			EGLint attribs[] = {EGL_CONFIG_ID, configId, EGL_NONE};
+			if (!eglChooseConfig(display, attribs, &config, 1, &n) || n != 1)
+				throw std::runtime_error("shared_context: config of the shared context not found");
+
+			glGetIntegerv(GL_MAJOR_VERSION, &major);
+			glGetIntegerv(GL_MINOR_VERSION, &minor);
+		}
+
+		shared_context(const shared_context &) = delete;
+
+		~shared_context() {
+			release();
+		}
+
+		// creates the context and makes it current, on the helper thread
+		void makeCurrent() {
+			EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION, major, EGL_CONTEXT_MINOR_VERSION, minor, EGL_NONE};
+			ctx = eglCreateContext(display, config, share, contextAttribs);
+			if (ctx == EGL_NO_CONTEXT)
+				throw std::runtime_error("shared_context: eglCreateContext failed: " + std::to_string(eglGetError()));
+
+			EGLint surfaceAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+			surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+			if (!eglMakeCurrent(display, surface, surface, ctx)) {
+				release();
+				throw std::runtime_error("shared_context: eglMakeCurrent failed: " + std::to_string(eglGetError()));
+			}
+		}
+
+		// releases and destroys the context, on the helper thread
+		void release() {
+			if (ctx == EGL_NO_CONTEXT)
+				return;
+			if (eglGetCurrentContext() == ctx)
+				eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (surface != EGL_NO_SURFACE)
+				eglDestroySurface(display, surface), surface = EGL_NO_SURFACE;
+			eglDestroyContext(display, ctx), ctx = EGL_NO_CONTEXT;
+		}
+	};
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+#include "context.h"
+#include "program_cache.h"
+#include "render_executor.h"
+#include "render_target.h"
+#include "render_ticket.h"
+#include "state_cache.h"
+
+namespace gl {
+
+	/*
+	 * Stacks a burst of frames on the GPU, e.g. for denoising. Each addFrame() folds the current
+	 * content of the input texture into a per-pixel weighted running mean (and with variance enabled
+	 * the sum of squared deviations, after Welford/West) kept in fp32 targets, so integer inputs do
+	 * not overflow as with renderer2d::enableAccumulation(). getMean() and getVariance() resolve the
+	 * state into the output type T in one pass and one readback. The state stays on the GPU, so
+	 * stacking K frames costs K uploads and one readback per result.
+	 *
+	 * Per-pixel weights are the weight passed to addFrame() times the result of an optional GLSL
+	 * function set with setWeightFunction(), e.g. to reject outliers.
+	 */
+	template<typename T, int C>
+	class stacker {
+		// running state: mean at attachment 0, sum of weights at 1, sum of squared deviations at 2
+		struct state {
+			render_target<float, 4> mean;
+			texture2d<float, 1> wsum;
+			texture2d<float, 4> m2;
+
+			state(int w, int h) : mean(w, h, 0), wsum("wsum", w, h), m2("m2", w, h) {}
+		};
+
+		render_executor &executor;
+		int w, h;
+		bool variance;
+		texture_base &input;
+		std::string samplerPrefix;
+		std::string weightFunction = "float weight(vec4 x, vec4 mean, float wsum, ivec2 pos) { return 1.0; }";
+		std::atomic<bool> alive;
+		std::chrono::milliseconds responseTimeout{4000};
+
+		// executor thread only
+		GLuint stackProg = 0, resolveProg = 0;
+		GLint uWeight = -1, uMode = -1;
+		std::unique_ptr<state> states[2];
+		int cur = 0;
+		render_target<T, C> out;
+		int nFrames = 0;
+
+	public:
+		template<typename U, int K>
+		stacker(int width, int height, texture2d<U, K> &input, render_executor &executor, bool variance = false)
+				: executor(executor), w(width), h(height), variance(variance), input(input),
+				  samplerPrefix(is_float_texel<U>::value ? "" : std::is_signed<U>::value ? "i" : "u"),
+				  alive(false), out(width, height, 1) {
+			if (input.width != width || input.height != height)
+				throw std::invalid_argument("stacker: input size differs from the frame size");
+		}
+
+		stacker(const stacker &) = delete;
+
+		~stacker() {
+			if (!alive)
+				return;
+			try { executor.run([this]() { release(); }, responseTimeout); }
+			catch (std::runtime_error &e) { LOG_E << "~stacker(): " << e.what(); }
+		}
+
+		inline int width() const { return w; }
+
+		inline int height() const { return h; }
+
+		/*
+		 * Time callers wait for the executor to run a call before giving up (default 4s)
+		 */
+		void setResponseTimeout(std::chrono::milliseconds timeout) { responseTimeout = timeout; }
+
+		/*
+		 * Sets the GLSL source of `float weight(vec4 x, vec4 mean, float wsum, ivec2 pos)`, which
+		 * returns the weight of pixel x given the running mean and sum of weights. Before start().
+		 */
+		void setWeightFunction(const std::string &glsl) {
+			if (alive)
+				throw std::logic_error("stacker already started");
+			weightFunction = glsl;
+		}
+
+		// compiles the passes and allocates the fp32 state on the executor
+		void start() {
+			if (alive)
+				throw std::logic_error("stacker already started");
+			executor.run([this]() {
+				try { init(); }
+				catch (std::exception &) {
+					release(); // e.g. a weight function that does not compile
+					throw;
+				}
+			}, responseTimeout);
+			alive = true;
+		}
+
+		/*
+		 * Folds the input texture into the stack with weight. Returns without waiting for the GPU, the
+		 * ticket completes once the frame was uploaded, so the input data can be reused.
+		 */
+		render_ticket addFrame(float weight = 1.0f) {
+			checkAlive();
+			render_ticket done(-1u);
+			executor.post([this, weight, done]() mutable {
+				try {
+					stack(weight);
+					executor.getContext().checkAndThrowError("stacker::addFrame()");
+					done._complete();
+				}
+				catch (std::exception &e) {
+					LOG_E << "stacker: " << e.what();
+					done._complete(e.what());
+				}
+			});
+			return done;
+		}
+
+		// starts a new stack
+		void reset() {
+			checkAlive();
+			executor.run([this]() { clearState(*states[cur]), nFrames = 0; }, responseTimeout);
+		}
+
+		// frames stacked since start() or reset()
+		int frameCount() {
+			checkAlive();
+			int n = 0;
+			executor.run([this, &n]() { n = nFrames; }, responseTimeout);
+			return n;
+		}
+
+		// reads the weighted mean, rounded and clamped for integer T
+		void getMean(T *dst) {
+			resolve(0, dst);
+		}
+
+		// reads the weighted (population) variance, requires variance enabled in the constructor
+		void getVariance(T *dst) {
+			if (!variance)
+				throw std::logic_error("stacker::getVariance(): variance not enabled");
+			resolve(1, dst);
+		}
+
+		void getMean(HlBuf<T> &buffer) {
+			checkSize(buffer);
+			getMean(buffer.begin());
+		}
+
+		void getVariance(HlBuf<T> &buffer) {
+			checkSize(buffer);
+			getVariance(buffer.begin());
+		}
+
+	private:
+		void checkAlive() const {
+			if (!alive)
+				throw std::logic_error("stacker is not started");
+		}
+
+		void checkSize(const HlBuf<T> &buffer) const {
+			if (buffer.number_of_elements() != w * h * C)
+				throw std::runtime_error("stacker: invalid buffer size");
+		}
+
+		std::string header() const {
+			return std::string("#version 300 es\nprecision highp float;\n") +
+				   (variance ? "#define VARIANCE\n" : "");
+		}
+
+		std::string stackShader() const {
+			return header() + "uniform highp " + samplerPrefix + "sampler2D u_frame;\n" + R"GLSL(
+uniform highp sampler2D u_mean, u_wsum, u_m2;
+uniform float u_weight;
+layout(location = 0) out vec4 o_mean;
+layout(location = 1) out float o_wsum;
+#ifdef VARIANCE
+layout(location = 2) out vec4 o_m2;
+#endif
+)GLSL" + weightFunction + R"GLSL(
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	vec4 x = vec4(texelFetch(u_frame, pos, 0));
+	vec4 mean = texelFetch(u_mean, pos, 0);
+	float W = texelFetch(u_wsum, pos, 0).r;
+	float w = u_weight * weight(x, mean, W, pos);
+	float Wn = W + w;
+	vec4 delta = x - mean;
+	o_mean = Wn > 0.0 ? mean + delta * (w / Wn) : mean;
+	o_wsum = Wn;
+#ifdef VARIANCE
+	o_m2 = texelFetch(u_m2, pos, 0) + w * delta * (x - o_mean);
+#endif
+}
+)GLSL";
+		}
+
+		std::string resolveShader() const {
+			std::string outType = "vec4", convert = "v";
+			if (std::is_integral<T>::value) {
+				outType = std::is_signed<T>::value ? "ivec4" : "uvec4";
+				// the largest float not above the maximum, so the conversion is defined
+				float maxV = (float) std::numeric_limits<T>::max();
+				if ((double) maxV > (double) std::numeric_limits<T>::max())
+					maxV = std::nextafter(maxV, 0.0f);
+				convert = "clamp(floor(v + 0.5), " + std::to_string((float) std::numeric_limits<T>::min()) +
+						  ", " + std::to_string(maxV) + ")";
+			}
+			return header() + "out highp " + outType + " color;\n" + R"GLSL(
+uniform highp sampler2D u_mean, u_wsum, u_m2;
+uniform int u_mode;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	vec4 v = texelFetch(u_mean, pos, 0);
+#ifdef VARIANCE
+	if (u_mode == 1) {
+		float W = texelFetch(u_wsum, pos, 0).r;
+		v = W > 0.0 ? texelFetch(u_m2, pos, 0) / W : vec4(0.0);
+	}
+#endif
+	color = )GLSL" + outType + "(" + convert + ");\n}\n";
+		}
+
+		GLuint link(const std::string &fragSrc) {
+			auto &gl(executor.getContext());
+			GLuint p = program_cache::get().build(gl, {{GL_VERTEX_SHADER, state_cache::fullscreenVertexShader()},
+													   {GL_FRAGMENT_SHADER, fragSrc}});
+
+			// input on unit 0, state on units 1 to 3
+			state_cache::get().useProgram(p);
+			glUniform1i(glGetUniformLocation(p, "u_frame"), 0);
+			glUniform1i(glGetUniformLocation(p, "u_mean"), 1);
+			glUniform1i(glGetUniformLocation(p, "u_wsum"), 2);
+			glUniform1i(glGetUniformLocation(p, "u_m2"), 3);
+			return p;
+		}
+
+		void init() {
+			auto &gl(executor.getContext());
+			stackProg = link(stackShader());
+			uWeight = glGetUniformLocation(stackProg, "u_weight");
+			resolveProg = link(resolveShader());
+			uMode = glGetUniformLocation(resolveProg, "u_mode");
+
+			input.maybeInit();
+			for (auto &s : states) {
+				s.reset(new state(w, h));
+				s->mean.init();
+				s->mean.clear(); // attaches the mean
+				s->wsum.maybeInit(), s->m2.maybeInit();
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, s->wsum.getGlId(), 0);
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, s->m2.getGlId(), 0);
+				gl.checkAndThrowError("stacker: attach state");
+				GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+				glDrawBuffers(variance ? 3 : 2, drawBuffers);
+				s->mean.bind(true);
+				clearState(*s);
+			}
+			out.init(), out.clear();
+			gl.checkAndThrowError("stacker::start()");
+			LOG_I << "stacker: " << w << "x" << h << (variance ? " with variance" : "");
+		}
+
+		// deletes the programs and the state, executor thread only
+		void release() {
+			auto &state(state_cache::get());
+			for (GLuint *p : {&stackProg, &resolveProg})
+				if (*p) state.forgetProgram(*p), glDeleteProgram(*p), *p = 0;
+			for (auto &s : states) {
+				if (!s) continue;
+				for (GLuint id : {s->wsum.getGlId(), s->m2.getGlId()})
+					state.forgetTexture(id), glDeleteTextures(1, &id);
+				s->mean.deinit();
+				s.reset();
+			}
+			out.deinit();
+		}
+
+		void clearState(state &s) {
+			s.mean.bind();
+			state_cache::get().scissor(rect{0, 0, 0, 0});
+			const GLfloat zero[4] = {0, 0, 0, 0};
+			for (GLint i = 0; i < (variance ? 3 : 2); ++i)
+				glClearBufferfv(GL_COLOR, i, zero);
+		}
+
+		void bindState(state &s) {
+			auto &state(state_cache::get());
+			texture_base *texs[] = {&s.mean.texBuf, &s.wsum, &s.m2};
+			for (int i = 0; i < 3; ++i)
+				state.bindTexture(i + 1, GL_TEXTURE_2D, texs[i]->getGlId());
+		}
+
+		void stack(float weight) {
+			auto &state(state_cache::get());
+			auto &src(*states[cur]), &dst(*states[1 - cur]);
+
+			state.useProgram(stackProg);
+			glUniform1f(uWeight, weight);
+			state.blend(false);
+			dst.mean.bind();
+			state.viewport(0, 0, w, h);
+			state.scissor(rect{0, 0, 0, 0});
+
+			state.bindTexture(0, input.getGlTarget(), input.getGlId());
+			state.activeTexture(0); // uploads in _preRender() go to the active unit
+			input._preRender();
+			bindState(src);
+			state.drawFullscreen();
+			state.count();
+
+			cur = 1 - cur, ++nFrames;
+		}
+
+		void resolve(int mode, T *dst) {
+			checkAlive();
+			executor.run([this, mode, dst]() {
+				auto &state(state_cache::get());
+				state.useProgram(resolveProg);
+				glUniform1i(uMode, mode);
+				state.blend(false);
+				out.bind();
+				state.viewport(0, 0, w, h);
+				state.scissor(rect{0, 0, 0, 0});
+				bindState(*states[cur]);
+				state.drawFullscreen();
+				state.count();
+				executor.getContext().checkAndThrowError("stacker: resolve");
+				out.read(dst, w * h * C);
+			}, responseTimeout);
+		}
+	};
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "context.h"
+
+namespace gl {
+
+	/*
+	 * Shadows GL state to skip redundant state changes in the render loop, and owns the fullscreen
+	 * geometry. GL state belongs to a context and every glimp context stays current on the thread that
+	 * created it, so there is one cache per thread (see get()).
+	 * Code changing state behind the cache's back must call invalidate().
+	 */
+	class state_cache {
+		GLuint program = 0, framebuffer = 0, vao = 0, vbo = 0;
+		bool vaoBound = false;
+		int activeUnit = -1;
+		std::vector<std::pair<GLenum, GLuint>> units;
+		std::vector<GLuint> uniformBuffers;
+		int blendEnabled = -1;
+		GLenum blendSrc = 0, blendDst = 0, blendEq = 0;
+		GLint vp[4] = {-1, -1, -1, -1};
+		int scissorEnabled = -1;
+		GLint sc[4] = {-1, -1, -1, -1};
+		std::map<std::pair<GLuint, GLint>, GLint> uniforms1i;
+
+		uint32_t calls = 0;
+
+		state_cache() = default;
+
+	public:
+		static state_cache &get() {
+			thread_local state_cache cache;
+			return cache;
+		}
+
+		// GL calls issued through the cache (or reported with count()) since the thread started
+		inline uint32_t callCount() const { return calls; }
+
+		inline void count(uint32_t n = 1) { calls += n; }
+
+		void invalidate() {
+			program = 0, framebuffer = 0, activeUnit = -1;
+			units.clear();
+			uniformBuffers.clear();
+			blendEnabled = -1, blendSrc = blendDst = blendEq = 0;
+			vp[0] = vp[1] = vp[2] = vp[3] = -1;
+			scissorEnabled = -1;
+			sc[0] = sc[1] = sc[2] = sc[3] = -1;
+			uniforms1i.clear();
+			vaoBound = false; // the geometry survives, only its binding is unknown
+		}
+
+		void useProgram(GLuint p) {
+			if (program == p) return;
+			glUseProgram(p), ++calls;
+			program = p;
+		}
+
+		// must be called before deleting a program, as GL might recycle its name
+		void forgetProgram(GLuint p) {
+			if (program == p) program = 0;
+			for (auto it = uniforms1i.begin(); it != uniforms1i.end();)
+				it = (it->first.first == p) ? uniforms1i.erase(it) : std::next(it);
+		}
+
+		// must be called before deleting a framebuffer or texture, as GL might recycle the name
+		void forgetFramebuffer(GLuint fb) {
+			if (framebuffer == fb) framebuffer = 0;
+		}
+
+		void forgetTexture(GLuint id) {
+			for (auto &u : units)
+				if (u.second == id) u = {0, 0};
+		}
+
+		// must be called before deleting a buffer bound with bindUniformBuffer()
+		void forgetBuffer(GLuint id) {
+			for (auto &b : uniformBuffers)
+				if (b == id) b = 0;
+		}
+
+		void bindFramebuffer(GLuint fb) {
+			if (framebuffer == fb) return;
+			glBindFramebuffer(GL_FRAMEBUFFER, fb), ++calls;
+			framebuffer = fb;
+		}
+
+		void activeTexture(int unit) {
+			if (activeUnit == unit) return;
+			glActiveTexture(GL_TEXTURE0 + unit), ++calls;
+			activeUnit = unit;
+		}
+
+		/*
+		 * For code binding textures outside the cache (e.g. to create them) on the active unit: rebinds
+		 * what the cache holds for it, so units bound earlier stay valid, or forgets it if unknown.
+		 */
+		void restoreActiveTexture() {
+			if (activeUnit < 0) {
+				units.clear(); // any unit might have changed
+				return;
+			}
+			if (activeUnit >= (int) units.size())
+				return;
+			auto &u(units[activeUnit]);
+			if (u.second != 0) glBindTexture(u.first, u.second), ++calls;
+			else u = {0, 0};
+		}
+
+		void bindTexture(int unit, GLenum target, GLuint id) {
+			if (unit >= (int) units.size())
+				units.resize(unit + 1, {0, 0});
+			if (units[unit].first == target && units[unit].second == id) return;
+			activeTexture(unit);
+			glBindTexture(target, id), ++calls;
+			units[unit] = {target, id};
+		}
+
+		// binds a buffer to an indexed GL_UNIFORM_BUFFER binding point
+		void bindUniformBuffer(GLuint index, GLuint id) {
+			if (index >= uniformBuffers.size())
+				uniformBuffers.resize(index + 1, 0);
+			if (uniformBuffers[index] == id) return;
+			glBindBufferBase(GL_UNIFORM_BUFFER, index, id), ++calls;
+			uniformBuffers[index] = id;
+		}
+
+		void uniform1i(GLint loc, GLint v) {
+			auto key = std::make_pair(program, loc);
+			auto it = uniforms1i.find(key);
+			if (it != uniforms1i.end() && it->second == v) return;
+			glUniform1i(loc, v), ++calls;
+			uniforms1i[key] = v;
+		}
+
+		void blend(bool enable) {
+			if (blendEnabled == (int) enable) return;
+			if (enable) glEnable(GL_BLEND);
+			else glDisable(GL_BLEND);
+			++calls;
+			blendEnabled = enable;
+		}
+
+		void blendFunc(GLenum src, GLenum dst, GLenum eq = GL_FUNC_ADD) {
+			if (blendSrc != src || blendDst != dst) {
+				glBlendFunc(src, dst), ++calls;
+				blendSrc = src, blendDst = dst;
+			}
+			if (blendEq != eq) {
+				glBlendEquation(eq), ++calls;
+				blendEq = eq;
+			}
+		}
+
+		void viewport(GLint x, GLint y, GLint w, GLint h) {
+			if (vp[0] == x && vp[1] == y && vp[2] == w && vp[3] == h) return;
+			glViewport(x, y, w, h), ++calls;
+			vp[0] = x, vp[1] = y, vp[2] = w, vp[3] = h;
+		}
+
+		// an empty rect disables the scissor test
+		void scissor(const rect &r) {
+			bool enable = !r.empty();
+			if (scissorEnabled != (int) enable) {
+				if (enable) glEnable(GL_SCISSOR_TEST);
+				else glDisable(GL_SCISSOR_TEST);
+				++calls;
+				scissorEnabled = enable;
+			}
+			if (enable && (sc[0] != r.x || sc[1] != r.y || sc[2] != r.width || sc[3] != r.height)) {
+				glScissor(r.x, r.y, r.width, r.height), ++calls;
+				sc[0] = r.x, sc[1] = r.y, sc[2] = r.width, sc[3] = r.height;
+			}
+		}
+
+		// the vertex shader to pair with drawFullscreen()
+		static const char *fullscreenVertexShader() {
+			return R"GLSL(#version 300 es
+layout(location = 0) in mediump vec2 position;
+void main() {gl_Position = vec4(position, 0.0, 1.0);}
+)GLSL";
+		}
+
+		/*
+		 * Draws a single triangle covering the viewport (vertex attribute 0, clip space). Unlike a quad
+		 * it has no diagonal seam, where fragments would be shaded twice.
+		 */
+		void drawFullscreen() {
+			if (vao == 0) {
+				static const khronos_float_t vPositions[] = {-1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f};
+				glGenVertexArrays(1, &vao);
+				glBindVertexArray(vao);
+				glGenBuffers(1, &vbo);
+				glBindBuffer(GL_ARRAY_BUFFER, vbo);
+				glBufferData(GL_ARRAY_BUFFER, sizeof(vPositions), vPositions, GL_STATIC_DRAW);
+				glEnableVertexAttribArray(0);
+				glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+				gl::context::checkAndThrowError("state_cache::drawFullscreen(): fullscreen geometry");
+				vaoBound = true;
+			} else if (!vaoBound) {
+				glBindVertexArray(vao), ++calls;
+				vaoBound = true;
+			}
+			glDrawArrays(GL_TRIANGLES, 0, 3), ++calls;
+		}
+	};
+}
@@ -7,41 +7,64 @@ namespace gl {
 	template<typename T, int C>
 	struct pack_buffer {
 		GLuint pbo = 0;
-		std::function<void(void)> init;
 		size_t sizeBytes;
+		size_t capacity = 0; // allocated bytes, at least sizeBytes once used
+		buf_use use;
 
 		pack_buffer(int width, int height, buf_use use)
-				: sizeBytes(sizeof(T) * C * width * height) {
-			init = [=]() {
-				LOG_I << "init pack_buffer";
-				glGenBuffers(1, &pbo);
-				gl::context::checkAndThrowError("pack_buffer glGenBuffers");
-
-				if (use.cpuRead) {
-					glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
-					glBufferData(GL_PIXEL_PACK_BUFFER, sizeBytes, 0, GL_DYNAMIC_READ); // TODO
-					glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-				}
-
-				if (use.cpuWrite) {
-					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
-					glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeBytes, 0, GL_DYNAMIC_DRAW); // TODO
-					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-					LOG_D << "initalized unpack buffer " << pbo << " with size " << sizeBytes;
-				}
-
-				gl::context::checkAndThrowError("renderer2d glBufferData");
-			};
+				: sizeBytes(sizeof(T) * C * width * height), use(use) {}
+
+		// a plain member (no closure capturing this), so pack buffers can be moved into containers
+		void init() {
+			LOG_I << "init pack_buffer";
+			glGenBuffers(1, &pbo);
+			gl::context::checkAndThrowError("pack_buffer glGenBuffers");
+			allocate();
+		}
+
+		/*
+		 * Changes the size without GL calls. The storage is kept if large enough, otherwise it grows
+		 * on the next use.
+		 */
+		void resize(int width, int height) {
+			sizeBytes = sizeof(T) * C * width * height;
 		}
 
 
 		void read(texture2d <T, C> &tex, std::function<void(const T *)> &reader,
 				  Stopwatch *sw = nullptr) {
+			pack(tex, sw);
+			map(reader, sw);
+		}
+
+		/*
+		 * Starts glReadPixels of the bound framebuffer into the PBO and returns without waiting for
+		 * the GPU. Use map() to access the pixels.
+		 */
+		void pack(texture2d <T, C> &tex, Stopwatch *sw = nullptr) {
+			reserve();
 			glReadBuffer(GL_COLOR_ATTACHMENT0);
 			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
 			tex.read(nullptr, sizeBytes / sizeof(T)); // as glReadPixels(..., 0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 			if (sw)sw->measure("texRead");
-			auto ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeBytes, GL_MAP_READ_BIT);
+		}
+
+		// as pack(), but only the pixels in r, packed without row padding. Returns their size in bytes
+		size_t pack(texture2d <T, C> &tex, const rect &r) {
+			reserve();
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+			tex.read(r, nullptr);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return sizeof(T) * C * r.width * r.height;
+		}
+
+		// maps the first nBytes (0 for all) of the buffer for reading
+		void map(std::function<void(const T *)> &reader, Stopwatch *sw = nullptr, size_t nBytes = 0) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+			auto ptr = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, nBytes ? nBytes : sizeBytes, GL_MAP_READ_BIT);
+			gl::context::checkAndThrowError("pack_buffer::map(): glMapBufferRange");
 			if (sw)sw->measure("glMapBufferRange");
 			reader(reinterpret_cast<T *>(ptr));
 			//memcpy(dst, ptr, nBytes);
@@ -51,24 +74,69 @@ namespace gl {
 			if (sw)sw->measure("glUnmapBuffer");
 		}
 
-		void write(texture2d <T, C> &tex, std::function<void(T *)> &writer) {
+		void write(texture2d <T, C> &tex, std::function<void(T *)> &writer,
+				   GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) {
+			writer(mapWrite(mapFlags));
+			unmapAndUpload(tex);
+		}
+
+		// maps the buffer for writing, the pointer stays valid until unmapAndUpload()
+		T *mapWrite(GLbitfield mapFlags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) {
+			reserve();
 			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
 			gl::context::checkAndThrowError("pack_buffer::write(): glBindBuffer");
 
-			glBindTexture(GL_TEXTURE_2D, tex.getGlId());
-
 			// TODO glMapBuffer 
-			auto ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeBytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			auto ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sizeBytes, mapFlags);
 			gl::context::checkAndThrowError("pack_buffer::write(): glMapBufferRange" + std::to_string(sizeBytes));
-			writer(reinterpret_cast<T *>(ptr));
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return reinterpret_cast<T *>(ptr);
+		}
+
+		// unmaps a buffer mapped with mapWrite() without uploading it
+		void unmapWrite() {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			gl::context::checkAndThrowError("pack_buffer::unmapWrite(): glUnmapBuffer");
+		}
+
+		// unmaps a buffer mapped with mapWrite() and uploads it into tex
+		void unmapAndUpload(texture2d <T, C> &tex) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
 			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 			gl::context::checkAndThrowError("pack_buffer::write(): glUnmapBuffer");
 
+			glBindTexture(GL_TEXTURE_2D, tex.getGlId());
 			gl::context::checkAndThrowError("pack_buffer::write(): glBindTexture");
 			tex.write(nullptr, sizeBytes / sizeof(T));
 			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 		}
 
-		virtual void deinit() { glDeleteBuffers(1, &pbo); }
+		virtual void deinit() { glDeleteBuffers(1, &pbo), pbo = 0, capacity = 0; }
+
+	private:
+		void allocate() {
+			if (use.cpuRead) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+				glBufferData(GL_PIXEL_PACK_BUFFER, sizeBytes, 0, GL_DYNAMIC_READ); // TODO
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			}
+
+			if (use.cpuWrite) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+				glBufferData(GL_PIXEL_UNPACK_BUFFER, sizeBytes, 0, GL_DYNAMIC_DRAW); // TODO
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				LOG_D << "initalized unpack buffer " << pbo << " with size " << sizeBytes;
+			}
+
+			gl::context::checkAndThrowError("renderer2d glBufferData");
+			capacity = sizeBytes;
+		}
+
+		void reserve() {
+			if (pbo != 0 && sizeBytes > capacity)
+				allocate();
+		}
 	};
 }
\ No newline at end of file
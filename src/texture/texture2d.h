@@ -2,6 +2,8 @@
 
 #include "img/halide.h"
 #include "../context.h"
+#include "../half.h"
+#include "../state_cache.h"
 #include "texture_base.h"
 
 namespace gl {
@@ -11,29 +13,52 @@ namespace gl {
 		typedef F type;
 
 	private:
+		struct rect_upload {
+			rect r;
+			const F *data;
+			int rowStride;
+		};
+
 		const F *uploadData;
+		std::vector<F> converted; // of the last upload(const float *)
+		std::vector<rect_upload> rectUploads;
 		bool hostDirty = true;
 		bool externalOES = false;
 	protected:
 		int rowAlign;
 
+		static int alignmentOf(size_t rowBytes) {
+			for (int i = 8; i > 1; i /= 2) {
+				if (rowBytes % i == 0)
+					return i;
+			}
+			return 1;
+		}
+
 		virtual void doUpload(const F *data) {
 			if (externalOES)
 				throw std::runtime_error("cannot upload to external OES " + to_string());
 
+			if (data == 0)
+				return; // storage is allocated once in init()
 
 			glPixelStorei(GL_UNPACK_ALIGNMENT, rowAlign); // for upload glTexImg* TODO perf
 			glPixelStorei(GL_PACK_ALIGNMENT, rowAlign); // for download glReadPixel* TODO perf
 			gl::context::checkAndThrowError("textured2d::write(): glPixelStorei ", *this);
 
-			glTexImage2D(GL_TEXTURE_2D, 0, getGlSizedFormat(), width, height, 0, getGlFormat(),
-						 getGlType(), (const void *) data);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, getGlFormat(), getGlType(),
+							(const void *) data);
 
-			gl::context::checkAndThrowError("textured2d::write(): glTexImage2D with ", *this);
+			gl::context::checkAndThrowError("textured2d::write(): glTexSubImage2D with ", *this);
+		}
 
-			if (data == 0) {
-				LOG_V << "initialized " << to_string() << ", rowAlign=" << rowAlign;
-			}
+		void doUploadRect(const rect &r, const F *data, int rowStride) {
+			glPixelStorei(GL_UNPACK_ALIGNMENT, alignmentOf(rowStride * sizeof(F) * C));
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, rowStride);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height, getGlFormat(), getGlType(),
+							(const void *) data);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			gl::context::checkAndThrowError("textured2d::upload(rect): glTexSubImage2D with ", *this);
 		}
 
 	public:
@@ -48,23 +73,33 @@ namespace gl {
 				doUpload(uploadData);
 				hostDirty = false;
 			}
+			for (auto &u : rectUploads)
+				doUploadRect(u.r, u.data, u.rowStride);
+			rectUploads.clear();
 		}
 
 	public:
 		texture2d(const std::string name, int width, int height)
 				: texture_base(name, width, height), uploadData(nullptr) {
-			int rowStride = width * sizeof(F) * C;
-			if (height > 2 && rowStride < 16 * 1 * 4)
-				throw std::runtime_error("row stride too small!");
-			for (int i = 8; i >= 1; i /= 2) {
-				if (rowStride % i == 0) {
-					rowAlign = i;
-					break;
-				}
-			}
+			rowAlign = checkRowStride(width, height);
 		}
 
-		void upload(const F *data, size_t n) {
+		/*
+		 * Changes the size, from any thread while the texture is not used. Pending uploads are dropped.
+		 * An initialized texture gets new (empty) storage on its next use on the GL thread.
+		 */
+		virtual void resize(int w, int h) {
+			if (externalOES)
+				throw std::logic_error("cannot resize external OES " + to_string());
+			rowAlign = checkRowStride(w, h);
+			setSize(w, h);
+			uploadData = nullptr, hostDirty = false;
+			rectUploads.clear();
+		}
+
+		// virtual so textures with their own upload memory (texture_buffer_persistent) also take frames
+		// passed through a texture2d&, the other overloads end up here
+		virtual void upload(const F *data, size_t n) {
 			if (n != (width * height * C))
 				throw std::runtime_error("texture2d::upload(): invalid data length");
 
@@ -73,6 +108,26 @@ namespace gl {
 
 			uploadData = data;
 			hostDirty = true;
+			rectUploads.clear(); // superseded
+		}
+
+		/*
+		 * Updates only the pixels in r, e.g. the rows a sensor changed. data points to the first pixel
+		 * of the rectangle, rowStride is the distance of rows in pixels (0 for r.width).
+		 * As with upload(), the data is read on the next render, so it must stay valid until then.
+		 */
+		void upload(const rect &r, const F *data, int rowStride = 0) {
+			if (externalOES)
+				throw std::runtime_error("cannot upload to external OES " + to_string());
+
+			if (r.empty() || !r.inside(width, height))
+				throw std::runtime_error("texture2d::upload(): invalid rect for " + to_string());
+
+			if (rowStride == 0) rowStride = r.width;
+			if (rowStride < r.width)
+				throw std::runtime_error("texture2d::upload(): row stride smaller than rect width");
+
+			rectUploads.push_back({r, data, rowStride});
 		}
 
 		inline void upload(const HlBuf<F> &buf) {
@@ -82,6 +137,24 @@ namespace gl {
 			upload(buf.begin(), buf.number_of_elements());
 		}
 
+		/*
+		 * Uploads float data into a half float texture. The data is converted right away on the calling
+		 * thread (see half.h) into a copy held by the texture, which is uploaded on the next render.
+		 */
+		template<typename U = F, typename = typename std::enable_if<std::is_same<U, float16_t>::value>::type>
+		void upload(const float *data, size_t n) {
+			if (n != (size_t) width * height * C)
+				throw std::runtime_error("texture2d::upload(): invalid data length");
+			converted.resize(n);
+			half::fromFloat(data, converted.data(), n);
+			upload(converted.data(), n);
+		}
+
+		template<typename U = F, typename = typename std::enable_if<std::is_same<U, float16_t>::value>::type>
+		inline void upload(const HlBuf<float> &buf) {
+			upload(buf.begin(), buf.number_of_elements());
+		}
+
 		//void uploadSynced(const F *data, size_t dataLen, gl::context &gl) {
 //			upload(data, dataLen);
 		//}
@@ -89,19 +162,26 @@ namespace gl {
 
 		virtual void read(F *buf, int n) {
 			// supported types: GL_UNSIGNED_BYTE, GL_UNSIGNED_INT, GL_INT, or GL_FLOAT
+			// with less than 4 channels, the format must be GL_IMPLEMENTATION_COLOR_READ_FORMAT
 			glPixelStorei(GL_PACK_ALIGNMENT, rowAlign);
-			GLenum format = isInteger() ? GL_RGBA_INTEGER : GL_RGBA;
-			glReadPixels(0, 0, width, height, format, getGlType(), buf);
+			glReadPixels(0, 0, width, height, getGlFormat(), getGlType(), buf);
 			context::checkAndThrowError("texture::read(): glReadPixels ", *this);
 		}
 
+		// reads the pixels in r of the bound framebuffer, rows packed without padding
+		void read(const rect &r, F *buf) {
+			glPixelStorei(GL_PACK_ALIGNMENT, alignmentOf(r.width * sizeof(F) * C));
+			glReadPixels(r.x, r.y, r.width, r.height, getGlFormat(), getGlType(), buf);
+			context::checkAndThrowError("texture::read(rect): glReadPixels ", *this);
+		}
+
 		virtual void write(const F *buf, int n) {
 			if (externalOES)
 				throw std::runtime_error("cannot write to external OES " + to_string());
 			glPixelStorei(GL_UNPACK_ALIGNMENT, rowAlign);
-			glTexImage2D(GL_TEXTURE_2D, 0, getGlSizedFormat(), width, height, 0, getGlFormat(),
-						 getGlType(), (const void *) buf);
-			gl::context::checkAndThrowError("textured2d::write(): glTexImage2D with ", *this);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, getGlFormat(), getGlType(),
+							(const void *) buf);
+			gl::context::checkAndThrowError("textured2d::write(): glTexSubImage2D with ", *this);
 		}
 
 
@@ -116,7 +196,24 @@ namespace gl {
 				   (externalOES ? ", OES" : "") + ")";
 		}
 
+		// throws for sizes the texture cannot store, returns the unpack alignment of a row
+		static int checkRowStride(int width, int height) {
+			int rowStride = width * sizeof(F) * C;
+			if (height > 2 && rowStride < 16 * 1 * 4)
+				throw std::runtime_error("row stride too small!");
+			return alignmentOf(rowStride);
+		}
+
 	protected:
+
+		// immutable storage cannot change its size, so the texture is replaced
+		void reallocate() override {
+			state_cache::get().forgetTexture(id);
+			glDeleteTextures(1, &id), id = 0;
+			resized = false;
+			texture2d::init();
+		}
+
 		void init() override {
 			glGenTextures(1, &id);
 			gl::context::checkAndThrowError("texture(): glGenTextures");
@@ -133,26 +230,31 @@ namespace gl {
 			}
 
 			if (!externalOES) {
-				// init the texture (set size, type and format)
-				glTexImage2D(getGlTarget(), 0, getGlSizedFormat(), width, height, 0, getGlFormat(),
-							 getGlType(), 0);
+				// allocate immutable storage once, all uploads are glTexSubImage2D updates
+				glTexStorage2D(getGlTarget(), 1, getGlSizedFormat(), width, height);
+				gl::context::checkAndThrowError("texture(): glTexStorage2D", *this);
+				LOG_V << "initialized " << to_string() << ", rowAlign=" << rowAlign;
 			} else {
 				// see http://developer.android.com/reference/android/graphics/SurfaceTexture.html
 				// external textures will be updated externaly
 			}
+			state_cache::get().restoreActiveTexture(); // may run between binds of a frame (resize)
 		}
 
 		virtual void deinit() {
-			glDeleteTextures(1, &id);
+			glDeleteTextures(1, &id), id = 0;
+			resized = false;
 		}
 
 		bool isInteger() const {
-			return typeid(F) != typeid(float) && typeid(F) != typeid(double);
+			return !is_float_texel<F>::value;
 		}
 
 		GLenum getGlType() {
 			if (typeid(F) == typeid(float)) {
 				return GL_FLOAT;
+			} else if (typeid(F) == typeid(float16_t)) {
+				return GL_HALF_FLOAT;
 			} else if (typeid(F) == typeid(uint8_t)) {
 				return GL_UNSIGNED_BYTE;
 			} else if (typeid(F) == typeid(uint32_t)) {
@@ -170,6 +272,7 @@ namespace gl {
 
 #define RETURN_FROM_TYPE_GROUP(ARRAY_SET_NAME, NAME_OR_VALUE) int i = (C <= 1) ? 0 : (C - 1); \
         if (typeid(F) == typeid(float)) return ARRAY_SET_NAME ## _f32[i].NAME_OR_VALUE; \
+        else if (typeid(F) == typeid(float16_t)) return ARRAY_SET_NAME ## _f16[i].NAME_OR_VALUE; \
         else if (typeid(F) == typeid(uint32_t)) return ARRAY_SET_NAME ## _u32[i].NAME_OR_VALUE; \
         else if (typeid(F) == typeid(int32_t)) return ARRAY_SET_NAME ## _i32[i].NAME_OR_VALUE; \
         else if (typeid(F) == typeid(uint16_t)) return ARRAY_SET_NAME ## _u16[i].NAME_OR_VALUE; \
@@ -177,7 +280,7 @@ namespace gl {
         else if (typeid(F) == typeid(uint8_t)) return ARRAY_SET_NAME ## _u8[i].NAME_OR_VALUE; \
         else throw std::runtime_error("invalid texture format");
 
-		GLenum getGlSizedFormat() const {
+		GLenum getGlSizedFormat() const override {
 			RETURN_FROM_TYPE_GROUP(sfmts, value);
 		}
 
@@ -23,13 +23,23 @@ namespace gl {
 				: name(name), width(width), height(height) {}
 
 		GLuint id = 0;
+		bool resized = false; // storage is reallocated by the next getGlId(), on the GL thread
 
+		// changes the size of a texture that supports it, see texture2d::resize()
+		void setSize(int w, int h) {
+			width = w, height = h;
+			if (id != 0) resized = true;
+		}
 
-		inline void maybeInit() { if (id == 0) init(); }
+		virtual void reallocate() {
+			throw std::logic_error("cannot resize " + to_string());
+		}
 
 	public:
+		inline void maybeInit() { if (id == 0) init(); }
+
 		const std::string name;
-		const int width, height;
+		int width, height; // read-only, see texture2d::resize()
 
 		virtual std::string to_string() const {
 			return "texBase('" + name + "', #" + std::to_string(id) + ", "
@@ -40,18 +50,20 @@ namespace gl {
 
 		inline GLuint getGlId() {
 			if (id == 0) init();
+			else if (resized) reallocate();
 			return id;
 		}
 
 		virtual void _preRender() {};
 		virtual void _preRenderTarget() {};
 
-		const texture_base &operator=(const texture_base &o) {
-			return o;
-		}
+		texture_base &operator=(const texture_base &) = delete; // textures are bound by reference
 
 		virtual GLenum getGlTarget() { return GL_TEXTURE_2D; };
 
+		// the sized internal format, 0 if unknown (e.g. external images)
+		virtual GLenum getGlSizedFormat() const { return 0; };
+
 		std::string getGlTargetString() {
 			switch (getGlTarget()) {
 				case GL_TEXTURE_2D:
@@ -140,6 +140,7 @@ namespace gl {
 			glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // TODO perf
 			glEGLImageTargetTexture2DOES(getGlTarget(), eglImg);
 			_glCheckAndThrowError("texture_buffer::init(): glEGLImageTargetTexture2DOES");
+			state_cache::get().restoreActiveTexture();
 			//}
 
 
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <atomic>
+
+#include "../context.h"
+#include "../fence.h"
+#include "texture2d.h"
+
+namespace gl {
+
+	/*
+	 * DMA texture for platforms without AHardwareBuffer (see texture_buffer_android), built on a ring
+	 * of unpack buffers persistently and coherently mapped with GL_EXT_buffer_storage. upload() copies
+	 * into a free buffer right away on the calling thread, the next render only issues the transfer
+	 * into the texture. Fences of earlier transfers guard the reuse of a buffer. lock() hands a buffer
+	 * out for writing in place, the caller's data may be reused as soon as upload() returns.
+	 *
+	 * One producer thread. Without the extension (or before the texture is initialized on the GL
+	 * thread) the buffers are host memory, uploaded as texture2d does.
+	 */
+	template<typename T=float, int C = 4>
+	class texture_buffer_persistent : public texture2d<T, C> {
+		enum : int { slot_free, slot_writing, slot_ready, slot_in_flight };
+
+		struct slot {
+			std::atomic<int> state{slot_free};
+			std::atomic<uint32_t> seq{0}; // publication order, the newest ready slot is uploaded
+			std::atomic<T *> mapped{nullptr};
+			GLuint pbo = 0;
+			const T *src = nullptr; // what the producer wrote, mapped or host
+			std::vector<T> host;
+			fence consumed; // GL thread only
+
+		};
+
+		std::vector<slot> slots;
+		const buf_use usage;
+		uint32_t nextSeq = 0; // producer thread only
+		int locked = -1;
+		bool persistent = false;
+
+	public:
+		// bit layout of AHardwareBuffer usage flags, for lock()
+		static constexpr uint64_t cpu_read = 0x3, cpu_write = 0x30;
+
+		texture_buffer_persistent(const std::string &name, int width, int height, buf_use use = buf_use::to_gpu())
+				: texture2d<T, C>(name, width, height), slots(3), usage(use) {}
+
+		// storage is mapped at a fixed size
+		void resize(int w, int h) override {
+			throw std::logic_error("cannot resize " + to_string());
+		}
+
+		/*
+		 * Returns a buffer of width x height x C elements. With cpu_write the next frame is written in
+		 * place and uploaded after unlock(), otherwise it holds the pixels last uploaded.
+		 */
+		template<uint64_t RW>
+		inline T *lock(size_t n) {
+			checkSize(n, "lock");
+			if (locked != -1)
+				throw std::logic_error("texture_buffer_persistent::lock(): " + texture_base::name + " already locked");
+			if (RW & 0xF0) {
+				locked = acquire();
+				return const_cast<T *>(slots[locked].src);
+			}
+			return const_cast<T *>(newest());
+		}
+
+		inline void unlock() {
+			if (locked != -1)
+				publish(locked), locked = -1;
+		}
+
+		using texture2d<T, C>::upload;
+
+		void upload(const T *imgData, size_t n) override {
+			checkSize(n, "upload");
+			int i = acquire();
+			memcpy(const_cast<T *>(slots[i].src), imgData, n * sizeof(T));
+			publish(i);
+		}
+
+		// copies the pixels last uploaded, the buffers are no render target
+		inline void read(T *imgData, size_t n) {
+			checkSize(n, "read");
+			const T *src = newest();
+			if (src) memcpy(imgData, src, n * sizeof(T));
+		}
+
+		void _preRender() override {
+			// release buffers the GPU is done with
+			for (auto &s : slots) {
+				if (s.state == slot_in_flight && s.consumed.poll())
+					s.state = slot_free;
+			}
+
+			slot *s = nullptr;
+			for (auto &c : slots) {
+				if (c.state.load(std::memory_order_acquire) == slot_ready && (!s || c.seq > s->seq))
+					s = &c;
+			}
+			int expected = slot_ready;
+			if (s && s->state.compare_exchange_strong(expected, slot_in_flight, std::memory_order_acquire)) {
+				bool fromPbo = s->pbo && s->src == s->mapped.load();
+				if (fromPbo) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s->pbo);
+				texture2d<T, C>::write(fromPbo ? nullptr : s->src, 0);
+				if (fromPbo) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				s->consumed.insert();
+				reserveFree();
+			}
+			texture2d<T, C>::_preRender();
+		}
+
+		void init() override {
+			texture2d<T, C>::init();
+
+			auto ext = (const char *) glGetString(GL_EXTENSIONS);
+			auto bufferStorage = (PFNGLBUFFERSTORAGEEXTPROC) eglGetProcAddress("glBufferStorageEXT");
+			persistent = ext && strstr(ext, "GL_EXT_buffer_storage") && bufferStorage;
+			if (!persistent) {
+				LOG_W << to_string() << ": no GL_EXT_buffer_storage, uploading from host memory";
+				return;
+			}
+
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+			if (usage.cpuRead) flags |= GL_MAP_READ_BIT;
+			for (auto &s : slots) {
+				glGenBuffers(1, &s.pbo);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+				bufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes(), nullptr, flags);
+				auto ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes(), flags);
+				gl::context::checkAndThrowError("texture_buffer_persistent::init(): glMapBufferRange", *this);
+				s.mapped.store(reinterpret_cast<T *>(ptr), std::memory_order_release);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			LOG_V << "initialized " << to_string() << " with " << slots.size() << " mapped buffers";
+		}
+
+		void deinit() override {
+			for (auto &s : slots) {
+				s.consumed.reset();
+				if (s.pbo) {
+					s.mapped = nullptr;
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+					glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					glDeleteBuffers(1, &s.pbo), s.pbo = 0;
+				}
+				s.src = nullptr;
+				s.state = slot_free;
+			}
+			locked = -1;
+			texture2d<T, C>::deinit();
+		}
+
+		std::string to_string() const override {
+			return "texBufPersistent(" + texture2d<T, C>::to_string() + (persistent ? "" : ", host") + ")";
+		}
+
+	private:
+		inline size_t bytes() const {
+			return sizeof(T) * C * texture_base::width * texture_base::height;
+		}
+
+		void checkSize(size_t n, const char *fn) const {
+			if (n != (size_t) texture_base::width * texture_base::height * C)
+				throw std::runtime_error(std::string("texture_buffer_persistent::") + fn + "(): invalid buf size "
+										 + std::to_string(n) + " for " + to_string());
+		}
+
+		// claims a free buffer for writing, else the ready one (its frame is superseded)
+		int acquire() {
+			for (int from : {slot_free, slot_ready}) {
+				for (size_t i = 0; i < slots.size(); i++) {
+					int expected = from;
+					if (!slots[i].state.compare_exchange_strong(expected, slot_writing, std::memory_order_acquire))
+						continue;
+					slot &s(slots[i]);
+					s.src = s.mapped.load(std::memory_order_acquire);
+					if (!s.src) {
+						s.host.resize(bytes() / sizeof(T));
+						s.src = s.host.data();
+					}
+					return (int) i;
+				}
+			}
+			throw std::logic_error("texture_buffer_persistent: no free buffer in " + to_string()
+								   + ", more than one producer?");
+		}
+
+		void publish(int i) {
+			slots[i].seq = ++nextSeq;
+			slots[i].state.store(slot_ready, std::memory_order_release);
+			// older ready frames are superseded
+			for (size_t j = 0; j < slots.size(); j++) {
+				int expected = slot_ready;
+				if (j != (size_t) i && slots[j].seq < slots[i].seq)
+					slots[j].state.compare_exchange_strong(expected, slot_free);
+			}
+		}
+
+		const T *newest() const {
+			const slot *s = nullptr;
+			for (auto &c : slots) {
+				if (c.state != slot_writing && c.src && (!s || c.seq > s->seq))
+					s = &c;
+			}
+			return s ? s->src : nullptr;
+		}
+
+		// keeps a buffer free for the producer, waiting for the oldest transfer if needed
+		void reserveFree() {
+			slot *oldest = nullptr;
+			for (auto &s : slots) {
+				if (s.state != slot_in_flight)
+					return;
+				if (!oldest || s.seq < oldest->seq)
+					oldest = &s;
+			}
+			oldest->consumed.wait(GL_TIMEOUT_IGNORED);
+			oldest->state = slot_free;
+		}
+	};
+}
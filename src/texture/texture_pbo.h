@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../fence.h"
 #include "texture2d.h"
 #include "pack_buffer.h"
 
@@ -7,20 +8,155 @@ namespace gl {
 	template<typename T=float, int C = 4>
 	class texture_pbo : public texture2d<T, C> {
 		pack_buffer<T, C> pb;
+
+		// streaming mode: ring of unpack buffers, each guarded by a fence of its last upload
+		struct upload_slot {
+			pack_buffer<T, C> pb;
+			fence consumed;
+		};
+		std::vector<upload_slot> uploadRing;
+		int nextUploadSlot = 0;
+
+		// write lease (see beginWrite()), mapped on the GL thread, committed from any thread
+		pack_buffer<T, C> *leased = nullptr;
+		struct commit_flag {
+			std::atomic<bool> set{false};
+
+			commit_flag() = default;
+
+			commit_flag(const commit_flag &o) : set(o.set.load()) {} // textures stay movable
+		} committed;
+
 	public:
+		/*
+		 * Mapped upload memory handed to a producer, see beginWrite(). Holds w x h pixels of C
+		 * components, rows stride() pixels apart.
+		 */
+		class lease {
+			friend class texture_pbo;
+			T *ptr = nullptr;
+			int w = 0, h = 0;
+			pack_buffer<T, C> *buf = nullptr;
+
+		public:
+			inline T *data() const { return ptr; }
+
+			inline int stride() const { return w; }
+
+			inline size_t size() const { return (size_t) w * h * C; }
+
+			inline explicit operator bool() const { return ptr != nullptr; }
+		};
+
 		texture_pbo(const std::string &name, int width, int height, buf_use use)
 				: texture2d<T, C>(name, width, height), pb(width, height, use) {}
 
+		// moves the fences of the upload ring along, they cannot be copied
+		texture_pbo(texture_pbo &&) = default;
+
 		~texture_pbo() {}
 
+		/*
+		 * Uploads through a ring of k unpack buffers. The host copy of frame N+1 goes into a free buffer
+		 * mapped with GL_MAP_UNSYNCHRONIZED_BIT while the GPU may still read the buffer of frame N.
+		 * Fences guard the reuse of a buffer, so the driver does not need to sync implicitly.
+		 */
+		void enableStreaming(int k = 3) {
+			if (texture_base::id != 0)
+				throw std::logic_error("texture_pbo::enableStreaming(): already initialized");
+			if (k < 2)
+				throw std::invalid_argument("texture_pbo::enableStreaming(): need at least 2 buffers");
+
+			uploadRing.clear();
+			for (int i = 0; i < k; i++)
+				uploadRing.push_back({{texture_base::width, texture_base::height, buf_use::to_gpu()}, fence()});
+		}
+
+		inline bool isStreaming() const { return !uploadRing.empty(); }
+
+		// as texture2d::resize(), pack buffers are reused if large enough
+		void resize(int w, int h) override {
+			texture2d<T, C>::resize(w, h);
+			pb.resize(w, h);
+			for (auto &s : uploadRing)
+				s.pb.resize(w, h);
+		}
+
+		/*
+		 * Maps the next unpack buffer (of the streaming ring, otherwise the buffer of a texture with
+		 * buf_use cpuWrite) for the caller to write the next frame into, which saves the copy of
+		 * upload(). On the GL thread, e.g. through renderer2d::beginWrite(). The lease can be filled on
+		 * any thread and must be passed to commit(), its pixels are uploaded on the next render.
+		 * One lease at a time.
+		 */
+		lease beginWrite() {
+			if (leased)
+				throw std::logic_error("texture_pbo::beginWrite(): " + texture_base::name + " already leased");
+			texture_base::getGlId(); // initialized with the current size
+
+			lease l;
+			if (isStreaming()) {
+				auto &s(uploadRing[nextUploadSlot]);
+				if (!s.consumed.poll()) {
+					LOG_V << "texture_pbo " << texture_base::name << ": upload ring full, waiting for the GPU";
+					s.consumed.wait(GL_TIMEOUT_IGNORED);
+				}
+				l.ptr = s.pb.mapWrite(GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+				l.buf = &s.pb;
+			} else {
+				if (!pb.use.cpuWrite)
+					throw std::logic_error("texture_pbo::beginWrite(): " + texture_base::name + " not writable");
+				l.ptr = pb.mapWrite();
+				l.buf = &pb;
+			}
+			l.w = texture_base::width, l.h = texture_base::height;
+			leased = l.buf;
+			return l;
+		}
+
+		// hands a filled lease back for upload, from any thread
+		void commit(lease &l) {
+			if (!l || l.buf != leased || committed.set)
+				throw std::logic_error("texture_pbo::commit(): not the current lease of " + texture_base::name);
+			committed.set.store(true, std::memory_order_release);
+			l.ptr = nullptr;
+		}
+
+		// gives an uncommitted lease back without uploading it, on the GL thread
+		void discard(lease &l) {
+			if (!l || l.buf != leased || committed.set)
+				throw std::logic_error("texture_pbo::discard(): not the current lease of " + texture_base::name);
+			leased->unmapWrite();
+			leased = nullptr;
+			l.ptr = nullptr;
+		}
+
+		void _preRender() override {
+			if (committed.set.load(std::memory_order_acquire)) {
+				leased->unmapAndUpload(*this);
+				if (isStreaming()) {
+					uploadRing[nextUploadSlot].consumed.insert();
+					nextUploadSlot = (nextUploadSlot + 1) % uploadRing.size();
+				}
+				leased = nullptr;
+				committed.set = false;
+			}
+			texture2d<T, C>::_preRender();
+		}
+
 		void init() override {
 			pb.init();
+			for (auto &s : uploadRing)
+				s.pb.init();
 			texture2d<T, C>::init();
 		}
 
 		void deinit() override {
+			leased = nullptr, committed.set = false; // deleting unmaps
 			texture2d<T, C>::deinit();
 			pb.deinit();
+			for (auto &s : uploadRing)
+				s.consumed.reset(), s.pb.deinit();
 		}
 
 
@@ -42,7 +178,24 @@ namespace gl {
 				if (data != nullptr)
 					memcpy(dst, data, nBytes);
 			};
-			pb.write(*this, writer);
+
+			if (data == nullptr)
+				return; // storage already allocated by init()
+
+			if (!isStreaming()) {
+				pb.write(*this, writer);
+				return;
+			}
+
+			auto &s(uploadRing[nextUploadSlot]);
+			if (!s.consumed.poll()) {
+				LOG_V << "texture_pbo " << texture_base::name << ": upload ring full, waiting for the GPU";
+				s.consumed.wait(GL_TIMEOUT_IGNORED);
+			}
+			s.pb.write(*this, writer,
+					   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			s.consumed.insert();
+			nextUploadSlot = (nextUploadSlot + 1) % uploadRing.size();
 		}
 	};
 }
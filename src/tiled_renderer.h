@@ -0,0 +1,134 @@
+#pragma once
+
+#include <deque>
+
+#include "renderer2d.h"
+#include "texture/texture_pbo.h"
+
+namespace gl {
+
+	/*
+	 * Runs a fragment shader over images of any size by splitting them into tiles, e.g. for images
+	 * beyond GL_MAX_TEXTURE_SIZE or to bound GPU memory. Each tile is rendered with a border of halo
+	 * pixels, which must cover the shader's stencil radius, and only its interior is stitched into
+	 * the output. Pixels outside the image read as the nearest edge pixel (as GL_CLAMP_TO_EDGE).
+	 *
+	 * The shader renders tiles of (tileSize + 2 * halo)^2 pixels, so WIDTH and HEIGHT are the tile
+	 * size. If it declares `uniform ivec2 u_tile_origin`, that is set to the image position of the
+	 * tile's first pixel. Uploads, rendering and readbacks of consecutive tiles overlap.
+	 */
+	template<typename T, int C>
+	class tiled_renderer {
+		int w, h, tileSize, halo, tw;
+		std::string inputName;
+
+		renderer2d<T, C> renderer;
+		texture_pbo<T, C> texTile;
+		std::vector<T> staging;
+
+		struct tile_in_flight {
+			render_ticket ticket;
+			rect core;
+			std::vector<T> *buf;
+		};
+		std::vector<std::vector<T>> tileBufs;
+		bool tileOrigin = false; // the shader declares u_tile_origin
+
+	public:
+		tiled_renderer(int width, int height, const std::string &fragShaderSrc,
+					   const std::string &inputName, context &gl, int tileSize = 1024, int halo = 0)
+				: w(width), h(height), tileSize(tileSize), halo(halo), tw(tileSize + 2 * halo),
+				  inputName(inputName), renderer(tw, tw, fragShaderSrc, gl),
+				  texTile{"tile", tw, tw, buf_use::to_gpu()}, staging((size_t) tw * tw * C),
+				  tileBufs(3, std::vector<T>((size_t) tw * tw * C)) {
+			if (tileSize < 1 || halo < 0)
+				throw std::invalid_argument("tiled_renderer: invalid tile size or halo");
+			texTile.enableStreaming(3);
+			renderer.addInput(inputName, texTile);
+			renderer.setMaxFramesInFlight(2);
+			renderer.setReadbackRingSize(2);
+		}
+
+		// fails before allocating anything if tiles exceed the GL limits (see renderer2d::checkLimits())
+		void startBackgroundRenderThread() {
+			renderer.startBackgroundRenderThread();
+
+			bool found = false;
+			renderer.updateUniforms([&found](GLuint prog) {
+				found = glGetUniformLocation(prog, "u_tile_origin") != -1;
+			}).wait();
+			tileOrigin = found;
+		}
+
+		inline int width() const { return w; }
+
+		inline int height() const { return h; }
+
+		inline int tilesX() const { return (w + tileSize - 1) / tileSize; }
+
+		inline int tilesY() const { return (h + tileSize - 1) / tileSize; }
+
+		/*
+		 * Renders src (width() * height() * C elements) into dst of the same size, tile by tile.
+		 */
+		void render(const T *src, T *dst) {
+			std::deque<tile_in_flight> inFlight;
+			size_t nextBuf = 0;
+
+			for (int ty = 0; ty < tilesY(); ++ty) {
+				for (int tx = 0; tx < tilesX(); ++tx) {
+					rect core{tx * tileSize, ty * tileSize,
+							  std::min(tileSize, w - tx * tileSize), std::min(tileSize, h - ty * tileSize)};
+
+					if (inFlight.size() == tileBufs.size())
+						stitch(inFlight.front(), dst), inFlight.pop_front();
+
+					stage(src, core.x - halo, core.y - halo);
+					texTile.upload(staging.data(), staging.size());
+
+					int32_t origin[2] = {core.x - halo, core.y - halo};
+					if (tileOrigin) renderer.setUniform("u_tile_origin", origin, 2); // applied by submit()
+
+					auto &buf(tileBufs[nextBuf++ % tileBufs.size()]);
+					inFlight.push_back({renderer.submit(buf.data()), core, &buf});
+				}
+			}
+
+			while (!inFlight.empty())
+				stitch(inFlight.front(), dst), inFlight.pop_front();
+		}
+
+		void render(const HlBuf<T> &src, HlBuf<T> &dst) {
+			if (src.number_of_elements() != (size_t) w * h * C ||
+				dst.number_of_elements() != (size_t) w * h * C)
+				throw std::runtime_error("tiled_renderer::render(): invalid buffer size");
+			render(src.begin(), dst.begin());
+		}
+
+	private:
+		// copies the tile starting at image position (x0, y0) into staging, clamping at the borders
+		void stage(const T *src, int x0, int y0) {
+			int xa = std::max(0, -x0), xb = std::min(tw, w - x0); // columns inside the image
+			for (int y = 0; y < tw; ++y) {
+				int sy = std::min(std::max(y0 + y, 0), h - 1);
+				const T *srow = src + (size_t) sy * w * C;
+				T *drow = staging.data() + (size_t) y * tw * C;
+
+				memcpy(drow + xa * C, srow + (x0 + xa) * C, sizeof(T) * C * (xb - xa));
+				for (int x = 0; x < xa; ++x)
+					memcpy(drow + x * C, srow, sizeof(T) * C);
+				for (int x = xb; x < tw; ++x)
+					memcpy(drow + x * C, srow + (w - 1) * C, sizeof(T) * C);
+			}
+		}
+
+		void stitch(tile_in_flight &t, T *dst) {
+			t.ticket.wait();
+			for (int y = 0; y < t.core.height; ++y) {
+				const T *srow = t.buf->data() + ((size_t) (y + halo) * tw + halo) * C;
+				memcpy(dst + ((size_t) (t.core.y + y) * w + t.core.x) * C, srow,
+					   sizeof(T) * C * t.core.width);
+			}
+		}
+	};
+}
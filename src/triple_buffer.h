@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace gl {
+
+	/*
+	 * Hands the latest frame from one writer thread to one reader thread without locks or waiting.
+	 * The writer fills writeBuffer() and publishes it, the reader acquires the most recent published
+	 * buffer. Frames published faster than they are acquired are overwritten (dropped).
+	 */
+	template<typename E>
+	class triple_buffer {
+		std::vector<E> bufs[3];
+		// index of the shared middle buffer, FRESH set while it holds a frame not acquired yet
+		std::atomic<uint8_t> middle;
+		uint8_t back = 0, front = 2; // owned by the writer and the reader
+		static constexpr uint8_t FRESH = 4;
+
+	public:
+		explicit triple_buffer(size_t n) : bufs{std::vector<E>(n), std::vector<E>(n), std::vector<E>(n)},
+										   middle(1) {}
+
+		triple_buffer(const triple_buffer &) = delete;
+
+		inline size_t size() const { return bufs[0].size(); }
+
+		inline E *writeBuffer() { return bufs[back].data(); }
+
+		/*
+		 * Makes the write buffer the latest frame. Returns false if this dropped the previously
+		 * published frame because it was never acquired. Writer thread only.
+		 */
+		bool publish() {
+			uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+			back = old & 3;
+			return !(old & FRESH);
+		}
+
+		/*
+		 * Takes the latest published frame, if there is one newer than readBuffer(). Reader thread only.
+		 */
+		bool acquire() {
+			if (!(middle.load(std::memory_order_relaxed) & FRESH))
+				return false;
+			front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+			return true;
+		}
+
+		inline const E *readBuffer() const { return bufs[front].data(); }
+	};
+}
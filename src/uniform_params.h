@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "context.h"
+#include "state_cache.h"
+
+namespace gl {
+
+	/*
+	 * Typed shader parameters, set from any thread and applied on the render thread before draws.
+	 * Members of uniform blocks (e.g. `layout(std140) uniform params { float gain; vec3 wb; };`) are
+	 * written into a copy of their block, which is uploaded with one glBufferSubData() per block and
+	 * frame, other uniforms are set with glUniform*(). Names are those GL reports (`block.member` for
+	 * blocks with an instance name, `name[0]` addresses arrays as does `name`). Values keep applying
+	 * when the program changes, e.g. on hot reload. Vectors, matrices (column-major) and arrays are
+	 * passed as flat lists of components, ints and floats convert into each other.
+	 */
+	class uniform_params {
+		struct value {
+			GLenum base; // GL_FLOAT, GL_INT or GL_UNSIGNED_INT
+			std::vector<uint32_t> words;
+		};
+
+		struct member {
+			GLenum base;
+			int cols, rows, size;
+			GLint block, offset, arrayStride, matrixStride, location;
+		};
+
+		struct block {
+			GLuint buffer = 0;
+			std::vector<uint8_t> data;
+			size_t lo = 0, hi = 0; // dirty range
+		};
+
+		std::mutex mutex;
+		std::map<std::string, value> pending;
+		std::atomic<bool> dirty{false};
+
+		// render thread only
+		std::map<std::string, value> values;
+		GLuint prog = 0;
+		uint32_t generation = 0;
+		std::map<std::string, member> members;
+		std::vector<block> blocks;
+		std::set<std::string> warned;
+
+	public:
+		uniform_params() = default;
+
+		uniform_params(const uniform_params &) = delete;
+
+		// base is GL_FLOAT, GL_INT or GL_UNSIGNED_INT, words the n components as 32 bit values
+		void set(const std::string &name, GLenum base, const void *words, size_t n) {
+			value v{base, std::vector<uint32_t>(n)};
+			memcpy(v.words.data(), words, n * sizeof(uint32_t));
+			std::lock_guard<std::mutex> lock(mutex);
+			pending[name] = std::move(v);
+			dirty = true;
+		}
+
+		/*
+		 * Uploads changed values for prog, which must be in use, and binds its uniform buffers. The
+		 * caller bumps generation whenever it replaces the program, a new one may get the old name.
+		 */
+		void apply(GLuint p, uint32_t gen) {
+			auto &state(state_cache::get());
+			if (p != prog || gen != generation) {
+				reflect(p), generation = gen;
+				for (auto &v : values)
+					write(v.first, v.second);
+			}
+			if (dirty) {
+				std::map<std::string, value> changed;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					changed.swap(pending);
+					dirty = false;
+				}
+				for (auto &v : changed) {
+					write(v.first, v.second);
+					values[v.first] = std::move(v.second);
+				}
+			}
+			for (GLuint i = 0; i < blocks.size(); ++i) {
+				block &b(blocks[i]);
+				if (b.hi > b.lo) {
+					glBindBuffer(GL_UNIFORM_BUFFER, b.buffer);
+					glBufferSubData(GL_UNIFORM_BUFFER, b.lo, b.hi - b.lo, b.data.data() + b.lo);
+					state.count(2);
+					b.lo = b.hi = 0;
+				}
+				state.bindUniformBuffer(i, b.buffer);
+			}
+		}
+
+		// deletes the uniform buffers, on the render thread
+		void release() {
+			for (auto &b : blocks)
+				state_cache::get().forgetBuffer(b.buffer), glDeleteBuffers(1, &b.buffer);
+			blocks.clear();
+			members.clear();
+			prog = 0;
+		}
+
+	private:
+		// component type and shape of a uniform type, false for samplers and images
+		static bool shape(GLenum type, GLenum &base, int &cols, int &rows) {
+			cols = 1;
+			switch (type) {
+				case GL_FLOAT: base = GL_FLOAT, rows = 1; return true;
+				case GL_FLOAT_VEC2: base = GL_FLOAT, rows = 2; return true;
+				case GL_FLOAT_VEC3: base = GL_FLOAT, rows = 3; return true;
+				case GL_FLOAT_VEC4: base = GL_FLOAT, rows = 4; return true;
+				case GL_INT: case GL_BOOL: base = GL_INT, rows = 1; return true;
+				case GL_INT_VEC2: case GL_BOOL_VEC2: base = GL_INT, rows = 2; return true;
+				case GL_INT_VEC3: case GL_BOOL_VEC3: base = GL_INT, rows = 3; return true;
+				case GL_INT_VEC4: case GL_BOOL_VEC4: base = GL_INT, rows = 4; return true;
+				case GL_UNSIGNED_INT: base = GL_UNSIGNED_INT, rows = 1; return true;
+				case GL_UNSIGNED_INT_VEC2: base = GL_UNSIGNED_INT, rows = 2; return true;
+				case GL_UNSIGNED_INT_VEC3: base = GL_UNSIGNED_INT, rows = 3; return true;
+				case GL_UNSIGNED_INT_VEC4: base = GL_UNSIGNED_INT, rows = 4; return true;
+				case GL_FLOAT_MAT2: base = GL_FLOAT, cols = 2, rows = 2; return true;
+				case GL_FLOAT_MAT3: base = GL_FLOAT, cols = 3, rows = 3; return true;
+				case GL_FLOAT_MAT4: base = GL_FLOAT, cols = 4, rows = 4; return true;
+				case GL_FLOAT_MAT2x3: base = GL_FLOAT, cols = 2, rows = 3; return true;
+				case GL_FLOAT_MAT2x4: base = GL_FLOAT, cols = 2, rows = 4; return true;
+				case GL_FLOAT_MAT3x2: base = GL_FLOAT, cols = 3, rows = 2; return true;
+				case GL_FLOAT_MAT3x4: base = GL_FLOAT, cols = 3, rows = 4; return true;
+				case GL_FLOAT_MAT4x2: base = GL_FLOAT, cols = 4, rows = 2; return true;
+				case GL_FLOAT_MAT4x3: base = GL_FLOAT, cols = 4, rows = 3; return true;
+				default: return false;
+			}
+		}
+
+		static uint32_t convert(uint32_t w, GLenum from, GLenum to) {
+			if (from == to || (from != GL_FLOAT && to != GL_FLOAT))
+				return w; // int and uint share the bits
+			float f;
+			if (from == GL_FLOAT) {
+				memcpy(&f, &w, 4);
+				return to == GL_INT ? (uint32_t) (int32_t) f : (uint32_t) f;
+			}
+			f = from == GL_INT ? (float) (int32_t) w : (float) w;
+			memcpy(&w, &f, 4);
+			return w;
+		}
+
+		// looks up the uniforms and blocks of a new program
+		void reflect(GLuint p) {
+			prog = p;
+			members.clear();
+			warned.clear();
+
+			GLint nBlocks = 0;
+			glGetProgramiv(p, GL_ACTIVE_UNIFORM_BLOCKS, &nBlocks);
+			blocks.resize(std::max<size_t>(blocks.size(), nBlocks));
+			for (GLint i = 0; i < nBlocks; ++i) {
+				GLint size = 0;
+				glGetActiveUniformBlockiv(p, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+				glUniformBlockBinding(p, i, i);
+				block &b(blocks[i]);
+				if (!b.buffer) glGenBuffers(1, &b.buffer);
+				if ((size_t) size != b.data.size()) {
+					glBindBuffer(GL_UNIFORM_BUFFER, b.buffer);
+					glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+				}
+				b.data.assign(size, 0);
+				b.lo = 0, b.hi = size;
+			}
+
+			GLint n = 0;
+			glGetProgramiv(p, GL_ACTIVE_UNIFORMS, &n);
+			for (GLuint i = 0; i < (GLuint) n; ++i) {
+				char name[256];
+				GLint size = 0;
+				GLenum type = 0;
+				glGetActiveUniform(p, i, sizeof(name), nullptr, &size, &type, name);
+				member m{};
+				if (!shape(type, m.base, m.cols, m.rows))
+					continue;
+				m.size = size;
+				glGetActiveUniformsiv(p, 1, &i, GL_UNIFORM_BLOCK_INDEX, &m.block);
+				glGetActiveUniformsiv(p, 1, &i, GL_UNIFORM_OFFSET, &m.offset);
+				glGetActiveUniformsiv(p, 1, &i, GL_UNIFORM_ARRAY_STRIDE, &m.arrayStride);
+				glGetActiveUniformsiv(p, 1, &i, GL_UNIFORM_MATRIX_STRIDE, &m.matrixStride);
+				m.location = m.block == -1 ? glGetUniformLocation(p, name) : -1;
+
+				std::string s(name);
+				if (s.size() > 3 && s.compare(s.size() - 3, 3, "[0]") == 0)
+					members[s.substr(0, s.size() - 3)] = m;
+				members[s] = m;
+			}
+			context::checkAndThrowError("uniform_params: reflect program");
+		}
+
+		void write(const std::string &name, const value &v) {
+			auto it = members.find(name);
+			if (it == members.end()) {
+				if (warned.insert(name).second)
+					LOG_W << "shader uniform " << name << " not found/optimized out, ignore";
+				return;
+			}
+			const member &m(it->second);
+			size_t elemWords = (size_t) m.cols * m.rows;
+			size_t count = v.words.size() / elemWords;
+			if (v.words.empty() || v.words.size() % elemWords != 0 || count > (size_t) m.size) {
+				if (warned.insert(name).second)
+					LOG_W << "shader uniform " << name << ": " << v.words.size() << " components do not fit, ignore";
+				return;
+			}
+
+			std::vector<uint32_t> words(v.words);
+			for (auto &w : words)
+				w = convert(w, v.base, m.base);
+
+			if (m.block == -1) {
+				setDefault(m, count, words.data());
+				return;
+			}
+
+			block &b(blocks[m.block]);
+			size_t colBytes = m.rows * sizeof(uint32_t);
+			size_t lo = b.data.size(), hi = 0;
+			for (size_t e = 0; e < count; ++e) {
+				for (int c = 0; c < m.cols; ++c) {
+					size_t at = m.offset + e * m.arrayStride + c * m.matrixStride;
+					memcpy(&b.data[at], &words[(e * m.cols + c) * m.rows], colBytes);
+					lo = std::min(lo, at), hi = std::max(hi, at + colBytes);
+				}
+			}
+			if (b.hi > b.lo) lo = std::min(lo, b.lo), hi = std::max(hi, b.hi);
+			b.lo = lo, b.hi = hi;
+		}
+
+		static void setDefault(const member &m, size_t count, const uint32_t *words) {
+			auto n = (GLsizei) count;
+			auto f = reinterpret_cast<const GLfloat *>(words);
+			auto i = reinterpret_cast<const GLint *>(words);
+			auto u = reinterpret_cast<const GLuint *>(words);
+			if (m.cols > 1) {
+				switch (m.cols * 10 + m.rows) {
+					case 22: glUniformMatrix2fv(m.location, n, GL_FALSE, f); break;
+					case 33: glUniformMatrix3fv(m.location, n, GL_FALSE, f); break;
+					case 44: glUniformMatrix4fv(m.location, n, GL_FALSE, f); break;
+					case 23: glUniformMatrix2x3fv(m.location, n, GL_FALSE, f); break;
+					case 24: glUniformMatrix2x4fv(m.location, n, GL_FALSE, f); break;
+					case 32: glUniformMatrix3x2fv(m.location, n, GL_FALSE, f); break;
+					case 34: glUniformMatrix3x4fv(m.location, n, GL_FALSE, f); break;
+					case 42: glUniformMatrix4x2fv(m.location, n, GL_FALSE, f); break;
+					case 43: glUniformMatrix4x3fv(m.location, n, GL_FALSE, f); break;
+				}
+			} else if (m.base == GL_FLOAT) {
+				switch (m.rows) {
+					case 1: glUniform1fv(m.location, n, f); break;
+					case 2: glUniform2fv(m.location, n, f); break;
+					case 3: glUniform3fv(m.location, n, f); break;
+					case 4: glUniform4fv(m.location, n, f); break;
+				}
+			} else if (m.base == GL_INT) {
+				switch (m.rows) {
+					case 1: glUniform1iv(m.location, n, i); break;
+					case 2: glUniform2iv(m.location, n, i); break;
+					case 3: glUniform3iv(m.location, n, i); break;
+					case 4: glUniform4iv(m.location, n, i); break;
+				}
+			} else {
+				switch (m.rows) {
+					case 1: glUniform1uiv(m.location, n, u); break;
+					case 2: glUniform2uiv(m.location, n, u); break;
+					case 3: glUniform3uiv(m.location, n, u); break;
+					case 4: glUniform4uiv(m.location, n, u); break;
+				}
+			}
+			state_cache::get().count();
+		}
+	};
+}
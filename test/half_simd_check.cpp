@@ -0,0 +1,38 @@
+/*
+ * Checks the vector kernels of half.h against the scalar conversion, without GL or gtest, so it
+ * can be cross-compiled and run under qemu (see .github/workflows/half.yml).
+ * Build with -DEXPECT_SIMD='"NEON"' (or "F16C", "scalar") to also check the kernels are selected.
+ */
+#include <cstdio>
+#include <cstring>
+
+#include "half.h"
+
+int main() {
+	const size_t n = 1027; // not a multiple of the vector width, the remainder is scalar
+	static float v[n], back[n];
+	static gl::float16_t h[n];
+	for (size_t i = 0; i < n; i++) {
+		uint32_t u = (uint32_t) i * 2654435761u; // all exponents, subnormals and Inf
+		memcpy(&v[i], &u, 4);
+		if (v[i] != v[i]) v[i] = (float) i - 500.5f; // NaN payloads may differ
+	}
+
+	gl::half::fromFloat(v, h, n);
+	gl::half::toFloat(h, back, n);
+	for (size_t i = 0; i < n; i++) {
+		if (h[i].h != gl::half::fromFloat(v[i]).h || back[i] != gl::half::toFloat(h[i])) {
+			printf("half: mismatch at %zu (%g)\n", i, v[i]);
+			return 1;
+		}
+	}
+
+	printf("half: %s conversions match the scalar code\n", gl::half::simdName());
+#ifdef EXPECT_SIMD
+	if (strcmp(gl::half::simdName(), EXPECT_SIMD) != 0) {
+		printf("half: expected %s\n", EXPECT_SIMD);
+		return 1;
+	}
+#endif
+	return 0;
+}
@@ -1,8 +1,19 @@
 #include "gtest/gtest.h"
 #include "img/halide.h"
+#include "opengl/compute2d.h"
+#include "opengl/pipeline.h"
 #include "opengl/renderer2d.h"
+#include "opengl/stacker.h"
+#include "opengl/tiled_renderer.h"
 #include "../utils.h"
 
+#include <fstream>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/epoll.h>
+#endif
+
 TEST(renderer2d, download_f32) {
 	int w = 32, h = 32;
 	typedef float out_t;
@@ -290,6 +301,1476 @@ void main() {
 	LOG_I << "tex_u16_to_u16_12MPIX" << std::endl << sw.getStats();
 }
 
+TEST(renderer2d, submit_tickets) {
+	int w = 64, h = 16;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.setMaxFramesInFlight(2);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	std::vector<gl::render_ticket> tickets;
+	for (int i = 0; i < 5; i++) {
+		fillRand(hlImg, 1000);
+		texImg.upload(hlImg);
+		tickets.push_back(renderer.submit());
+	}
+
+	for (int i = 0; i < 5; i++) {
+		tickets[i].wait();
+		EXPECT_TRUE(tickets[i].done());
+		if (i > 0) EXPECT_EQ(tickets[i - 1].frameIndex() + 1, tickets[i].frameIndex());
+	}
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	renderer.getResult(hlOut);
+
+	auto ref = [&hlImg](int c, int x, int y) { return 1 + hlImg(c, x, y); };
+	COMP_RGBA(hlOut, ref, 0.0001);
+}
+
+TEST(renderer2d, submit_readback) {
+	int w = 64, h = 16, nFrames = 7;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.setReadbackRingSize(3);
+	renderer.setMaxFramesInFlight(3);
+	renderer.startBackgroundRenderThread();
+
+	std::vector<HlBuf<tex_t>> hlImg(nFrames, HlBuf<tex_t>{4, w, h});
+	std::vector<HlBuf<uint16_t>> hlOut(nFrames, HlBuf<uint16_t>{4, w, h});
+	std::vector<gl::render_ticket> tickets;
+	for (int i = 0; i < nFrames; i++) {
+		fillRand(hlImg[i], 1000);
+		texImg.upload(hlImg[i]);
+		tickets.push_back(renderer.submit(hlOut[i]));
+	}
+
+	for (int i = 0; i < nFrames; i++) {
+		tickets[i].wait();
+		auto ref = [&hlImg, i](int c, int x, int y) { return 1 + hlImg[i](c, x, y); };
+		COMP_RGBA(hlOut[i], ref, 0.0001);
+	}
+}
+
+TEST(renderer2d, tex_pbo_streaming) {
+	int w = 64, h = 16, nFrames = 7;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture_pbo<tex_t, 4> texImg{"texImg", w, h, gl::buf_use::to_gpu()};
+	texImg.enableStreaming(3);
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int i = 0; i < nFrames; i++) {
+		fillRand(hlImg, 1000);
+		texImg.upload(hlImg);
+		renderer.submit(hlOut).wait();
+
+		auto ref = [&hlImg](int c, int x, int y) { return 1 + hlImg(c, x, y); };
+		COMP_RGBA(hlOut, ref, 0.0001);
+	}
+}
+
+TEST(renderer2d, tex_upload_rect) {
+	int w = 64, h = 16;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	renderer.render();
+
+	// update a band of rows and a block, both from the full-frame host buffer
+	HlBuf<tex_t> hlOld = hlImg;
+	fillRand(hlImg, 1000);
+	gl::rect band{0, 3, w, 5}, block{17, 10, 9, 4};
+	texImg.upload(band, &hlImg(0, band.x, band.y), w);
+	texImg.upload(block, &hlImg(0, block.x, block.y), w);
+	renderer.render();
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	renderer.getResult(hlOut);
+
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			bool updated = (y >= 3 && y < 8) || (x >= 17 && x < 26 && y >= 10 && y < 14);
+			for (int c = 0; c < 4; ++c)
+				ASSERT_EQ(updated ? hlImg(c, x, y) : hlOld(c, x, y), hlOut(c, x, y));
+		}
+	}
+}
+
+TEST(renderer2d, steady_state_gl_calls) {
+	int w = 64, h = 16;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 2U * texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	renderer.render();
+	uint32_t firstFrameCalls = renderer.glCallsLastFrame();
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int i = 0; i < 3; i++) {
+		renderer.render();
+		renderer.getResult(hlOut);
+	}
+
+	// program, blend state, framebuffer, viewport, texture and sampler unit are unchanged:
+	// only the draw call and the error check remain
+	EXPECT_LT(renderer.glCallsLastFrame(), firstFrameCalls);
+	EXPECT_LE(renderer.glCallsLastFrame(), 2);
+
+	auto ref = [&hlImg](int c, int x, int y) { return 2 * hlImg(c, x, y); };
+	COMP_RGBA(hlOut, ref, 0.0001);
+}
+
+TEST(renderer2d, roi) {
+	int w = 64, h = 32;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	renderer.render();
+
+	// re-render a band only
+	HlBuf<tex_t> hlOld = hlImg;
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	gl::rect roi{5, 8, 40, 11};
+	renderer.render(roi);
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	renderer.getResult(hlOut);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			bool inRoi = x >= 5 && x < 45 && y >= 8 && y < 19;
+			for (int c = 0; c < 4; ++c)
+				ASSERT_EQ(1 + (inRoi ? hlImg(c, x, y) : hlOld(c, x, y)), hlOut(c, x, y));
+		}
+	}
+
+	// partial readback into the same place of a full-frame buffer
+	HlBuf<uint16_t> hlPart{4, w, h};
+	memset(hlPart.begin(), 0, hlPart.size_in_bytes());
+	gl::rect crop{3, 20, 17, 9};
+	renderer.getResult(crop, &hlPart(0, crop.x, crop.y), w);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			bool inCrop = x >= 3 && x < 20 && y >= 20 && y < 29;
+			for (int c = 0; c < 4; ++c)
+				ASSERT_EQ(inCrop ? hlOut(c, x, y) : 0, hlPart(c, x, y));
+		}
+	}
+
+	EXPECT_THROW(renderer.render(gl::rect{60, 0, 10, 10}), std::runtime_error);
+}
+
+TEST(renderer2d, mrt) {
+	int w = 64, h = 16;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+layout(location = 0) out highp uvec4 color;
+layout(location = 1) out highp vec4 scaled;
+layout(location = 2) out highp uint mask;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	uvec4 v = texelFetch(u_img, pos, 0);
+	color = 1U + v;
+	scaled = vec4(v) * 0.5;
+	mask = v.r > 500U ? 255U : 0U;
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	gl::render_target<float, 4> outScaled(w, h, 1);
+	gl::render_target<uint8_t, 1> outMask(w, h, 1);
+	renderer.addInput("u_img", texImg);
+	EXPECT_EQ(1, renderer.addOutput(outScaled));
+	EXPECT_EQ(2, renderer.addOutput(outMask));
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	renderer.render();
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	HlBuf<float> hlScaled{4, w, h};
+	HlBuf<uint8_t> hlMask{1, w, h};
+	renderer.getResult(hlOut);
+	renderer.getResult(outScaled, hlScaled);
+	renderer.getResult(outMask, hlMask);
+
+	auto ref = [&hlImg](int c, int x, int y) { return 1 + hlImg(c, x, y); };
+	COMP_RGBA(hlOut, ref, 0.0001);
+	auto refScaled = [&hlImg](int c, int x, int y) { return hlImg(c, x, y) * 0.5f; };
+	COMP_RGBA(hlScaled, refScaled, 0.0001);
+	auto refMask = [&hlImg](int c, int x, int y) { return hlImg(0, x, y) > 500 ? 255 : 0; };
+	COMP_RGBA(hlMask, refMask, 0.0001);
+}
+
+TEST(renderer2d, feedback_iterations) {
+	int w = 64, h = 16;
+
+	// each iteration adds the input to the previous output, saturating at 10
+	const char *shader = R"GLSL(#version 300 es
+uniform highp sampler2D u_prev;
+uniform highp sampler2D u_step;
+out highp vec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = min(texelFetch(u_prev, pos, 0) + texelFetch(u_step, pos, 0), vec4(10.0));
+}
+)GLSL";
+
+	HlBuf<float> hlStep{4, w, h}, hlOut{4, w, h};
+	std::fill(hlStep.begin(), hlStep.begin() + hlStep.number_of_elements(), 1.0f);
+
+	gl::renderer2d<float, 4> renderer(w, h, shader, getContext());
+	renderer.enableFeedback("u_prev");
+	gl::texture2d<float, 4> texStep{"texStep", w, h};
+	renderer.addInput("u_step", texStep); // after the feedback input
+	renderer.startBackgroundRenderThread();
+
+	texStep.upload(hlStep);
+	EXPECT_EQ(7, renderer.renderIterations(7));
+	renderer.getResult(hlOut);
+	auto seven = [](int c, int x, int y) { return 7.0f; };
+	COMP_RGBA(hlOut, seven, 0.0001);
+
+	// saturated after 3 more iterations, noticed by the check after 5
+	EXPECT_EQ(5, renderer.renderIterations(100, 5));
+	renderer.getResult(hlOut);
+	auto ten = [](int c, int x, int y) { return 10.0f; };
+	COMP_RGBA(hlOut, ten, 0.0001);
+
+	EXPECT_EQ(100, renderer.renderIterations(100, 3, -1.0f)); // never converges
+
+	gl::renderer2d<float, 4> noFeedback(w, h, shader, getContext());
+	EXPECT_THROW(noFeedback.renderIterations(3), std::logic_error);
+}
+
+TEST(renderer2d, hot_reload) {
+	int w = 32, h = 8;
+	std::string fn = "/tmp/glimp_hot_reload_test.glsl";
+	auto writeShader = [&fn](const std::string &value) {
+		// as editors do: write a temporary file and rename it over the watched one
+		std::ofstream(fn + ".tmp") << "#version 300 es\nuniform highp usampler2D u_img;\n"
+									  "out highp uvec4 color;\nvoid main() {\n"
+									  "\tcolor = texelFetch(u_img, ivec2(gl_FragCoord.xy), 0) + " << value << ";\n}\n";
+		std::rename((fn + ".tmp").c_str(), fn.c_str());
+	};
+	writeShader("1U");
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, "", getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.watchFragmentShaderFile(fn);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<uint16_t> hlImg{4, w, h}, hlOut{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+
+	// renders until the output is img + add, frames keep flowing while the watcher compiles
+	auto renderUntil = [&](int add) {
+		Stopwatch sw;
+		auto t0 = std::chrono::steady_clock::now();
+		while (std::chrono::steady_clock::now() - t0 < std::chrono::seconds(4)) {
+			sw.start();
+			renderer.render();
+			sw.measure("render");
+			renderer.getResult(hlOut);
+			if (hlOut(2, 3, 4) == hlImg(2, 3, 4) + add)
+				return true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+		LOG_I << "hot_reload" << std::endl << sw.getStats();
+		return false;
+	};
+
+	EXPECT_TRUE(renderUntil(1));
+	writeShader("2U");
+	EXPECT_TRUE(renderUntil(2));
+	writeShader("syntax error");
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_TRUE(renderUntil(2)); // the broken version is skipped
+	writeShader("3U");
+	EXPECT_TRUE(renderUntil(3));
+	auto ref = [&hlImg](int c, int x, int y) { return hlImg(c, x, y) + 3; };
+	COMP_RGBA(hlOut, ref, 0.0001);
+
+	// programs rebuilt after a resize are built for the new size
+	int w2 = 48;
+	texImg.resize(w2, h);
+	renderer.resize(w2, h);
+	hlImg = HlBuf<uint16_t>{4, w2, h}, hlOut = HlBuf<uint16_t>{4, w2, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	writeShader("uint(WIDTH)");
+	EXPECT_TRUE(renderUntil(w2));
+	std::remove(fn.c_str());
+}
+
+TEST(renderer2d, uniform_params) {
+	int w = 16, h = 8;
+	gl::renderer2d<float, 4> renderer(w, h, R"GLSL(#version 300 es
+precision highp float;
+layout(std140) uniform params {
+	float gain;
+	vec3 wb;
+	mat3 mix3;
+	float k[3];
+};
+uniform int u_bias;
+out vec4 color;
+void main() {
+	vec3 x = vec3(gl_FragCoord.x, gl_FragCoord.y, 1.0);
+	color = vec4(mix3 * (x * wb) * gain + (k[0] + k[1] + k[2]) + float(u_bias), 1.0);
+}
+)GLSL", getContext());
+
+	renderer.setUniform("gain", 1.0f);
+	renderer.setUniform("wb", {1.0f, 0.5f, 2.0f});
+	renderer.setUniform("mix3", {1, 0, 0, 1, 1, 0, 0, 0, 1}); // adds g to r
+	renderer.setUniform("k", std::vector<float>{0.25f, 0.5f, 0.25f});
+	renderer.setUniform("u_bias", 2);
+	renderer.startBackgroundRenderThread();
+
+	auto compiled = gl::program_cache::get().compiledCount();
+	HlBuf<float> hlOut{4, w, h};
+	for (int f = 0; f < 4; f++) {
+		float gain = f < 3 ? 1.0f + 0.5f * f : 3.0f;
+		if (f < 3) renderer.setUniform("gain", gain);
+		else renderer.setUniform("gain", 3); // converted to float
+		renderer.render();
+		renderer.getResult(hlOut);
+
+		auto ref = [gain](int c, int x, int y) {
+			float r = (x + 0.5f) * 1.0f, g = (y + 0.5f) * 0.5f, b = 2.0f;
+			float v[4] = {r + g, g, b, 1.0f};
+			return c == 3 ? 1.0f : v[c] * gain + 1.0f + 2.0f;
+		};
+		COMP_RGBA(hlOut, ref, 0.001);
+	}
+	EXPECT_EQ(compiled, gl::program_cache::get().compiledCount()) << "parameter changes recompiled";
+}
+
+TEST(renderer2d, resize) {
+	gl::renderer2d<uint16_t, 4> renderer(32, 8, R"GLSL(#version 300 es
+uniform highp usampler2D u_img, u_b;
+uniform highp uint u_add;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = texelFetch(u_img, pos, 0) + texelFetch(u_b, pos, 0) * 2u + uvec4(WIDTH, HEIGHT, u_add, 0);
+}
+)GLSL", getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", 32, 8}, texB{"texB", 32, 8};
+	renderer.addInput("u_img", texImg);
+	renderer.addInput("u_b", texB);
+	renderer.setUniform("u_add", 7u);
+	renderer.startBackgroundRenderThread();
+
+	// renders at w x h and checks the size macros, the inputs and the uniform
+	auto check = [&](int w, int h) {
+		HlBuf<uint16_t> hlImg{4, w, h}, hlB{4, w, h}, hlOut{4, w, h};
+		fillRand(hlImg, 1000);
+		fillRand(hlB, 1000);
+		texImg.upload(hlImg);
+		texB.upload(hlB);
+		renderer.render();
+		renderer.getResult(hlOut);
+		auto ref = [&](int c, int x, int y) {
+			return hlImg(c, x, y) + hlB(c, x, y) * 2 + (c == 0 ? w : c == 1 ? h : c == 2 ? 7 : 0);
+		};
+		COMP_RGBA(hlOut, ref, 0);
+	};
+	check(32, 8);
+
+	Stopwatch sw;
+	for (auto size : {std::make_pair(64, 16), std::make_pair(16, 4), std::make_pair(32, 8)}) {
+		auto compiled = gl::program_cache::get().compiledCount();
+		sw.start();
+		// both inputs get new storage on the next render, while binding its units
+		texImg.resize(size.first, size.second);
+		texB.resize(size.first, size.second);
+		renderer.resize(size.first, size.second);
+		sw.measure("resize to " + std::to_string(size.first) + "x" + std::to_string(size.second));
+		EXPECT_EQ(size.first, renderer.width());
+		check(size.first, size.second);
+		if (size.first == 32) // back to the first size, a cache lookup
+			EXPECT_EQ(compiled, gl::program_cache::get().compiledCount());
+	}
+	LOG_I << sw.getStats();
+
+	// sizes the targets cannot store fail before anything changes
+	auto compiled = gl::program_cache::get().compiledCount();
+	EXPECT_THROW(renderer.resize(2, 8), std::runtime_error); // row stride too small
+	EXPECT_THROW(renderer.resize(0, 8), std::runtime_error);
+	EXPECT_EQ(32, renderer.width());
+	EXPECT_EQ(compiled, gl::program_cache::get().compiledCount());
+	check(32, 8);
+}
+
+TEST(renderer2d, frame_limits) {
+	const char *shader = R"GLSL(#version 300 es
+out highp uvec4 color;
+void main() {
+	color = uvec4(WIDTH, HEIGHT, 0, 0);
+}
+)GLSL";
+	int tooWide = 1 << 16; // beyond GL_MAX_TEXTURE_SIZE of current GPUs
+
+	// fails with the limits instead of a GL error of the first allocation, the thread ends
+	gl::renderer2d<uint16_t, 4> oversized(tooWide, 4, shader, getContext());
+	try {
+		oversized.startBackgroundRenderThread();
+		FAIL() << "started with a frame of " << tooWide << "x4";
+	}
+	catch (std::runtime_error &e) {
+		EXPECT_NE(std::string::npos, std::string(e.what()).find("exceeds the GL limits")) << e.what();
+	}
+
+	gl::renderer2d<uint16_t, 4> renderer(32, 8, shader, getContext());
+	renderer.startBackgroundRenderThread();
+	EXPECT_THROW(renderer.resize(tooWide, 8), std::runtime_error);
+	EXPECT_EQ(32, renderer.width());
+	HlBuf<uint16_t> hlOut{4, 32, 8};
+	renderer.render();
+	renderer.getResult(hlOut);
+	auto ref = [](int c, int x, int y) { return c == 0 ? 32 : c == 1 ? 8 : 0; };
+	COMP_RGBA(hlOut, ref, 0);
+}
+
+TEST(renderer2d, upload_lease) {
+	int w = 256, h = 128, nFrames = 20;
+	gl::texture_pbo<uint16_t, 4> texRing{"texRing", w, h, gl::buf_use::to_gpu()}, texSingle{"texSingle", w, h, gl::buf_use::to_gpu()};
+	texRing.enableStreaming(3);
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_ring, u_single;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = texelFetch(u_ring, pos, 0) + texelFetch(u_single, pos, 0);
+}
+)GLSL", getContext());
+	renderer.addInput("u_ring", texRing);
+	renderer.addInput("u_single", texSingle);
+	renderer.startBackgroundRenderThread();
+
+	// as a decoder would: write each frame straight into the leased buffer
+	auto fill = [](uint16_t *dst, int stride, int h, int f) {
+		for (int y = 0; y < h; y++)
+			for (int x = 0; x < stride * 4; x++)
+				dst[(size_t) y * stride * 4 + x] = (uint16_t) ((x + y + f) & 0x3ff);
+	};
+
+	auto single = renderer.beginWrite(texSingle);
+	ASSERT_TRUE((bool) single);
+	std::fill(single.data(), single.data() + single.size(), (uint16_t) 1000);
+	texSingle.commit(single);
+	EXPECT_THROW(texSingle.commit(single), std::logic_error);
+
+	// a caller giving up on the blocked render thread does not leave the ring leased
+	std::atomic<bool> blocked{true};
+	auto blocker = renderer.updateUniforms([&blocked](GLuint) {
+		while (blocked) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	});
+	renderer.setResponseTimeout(std::chrono::milliseconds(20));
+	EXPECT_THROW(renderer.beginWrite(texRing), std::runtime_error);
+	blocked = false;
+	blocker.wait();
+	renderer.setResponseTimeout(std::chrono::milliseconds(4000));
+	auto again = renderer.beginWrite(texRing); // after the abandoned one in the queue
+	ASSERT_TRUE((bool) again);
+	texRing.commit(again);
+	renderer.render();
+
+	HlBuf<uint16_t> hlOut{4, w, h}, hlFrame{4, w, h};
+	Stopwatch sw;
+	for (int f = 0; f < nFrames; f++) {
+		sw.start();
+		auto lease = renderer.beginWrite(texRing);
+		ASSERT_EQ(w, lease.stride());
+		fill(lease.data(), lease.stride(), h, f);
+		texRing.commit(lease);
+		renderer.render();
+		if (f > 0) sw.measure("lease"); // the first frame maps the ring
+		renderer.getResult(hlOut);
+		auto ref = [f](int c, int x, int y) { return ((x * 4 + c + y + f) & 0x3ff) + 1000; };
+		COMP_RGBA(hlOut, ref, 0);
+	}
+
+	// the same through a host buffer and upload(), one more copy per frame
+	for (int f = 0; f < nFrames; f++) {
+		sw.start();
+		fill(hlFrame.begin(), w, h, f);
+		texRing.upload(hlFrame);
+		renderer.render();
+		if (f > 0) sw.measure("upload");
+	}
+	LOG_I << "upload_lease " << w << "x" << h << std::endl << sw.getStats();
+}
+
+TEST(renderer2d, texture_dma) {
+	int w = 256, h = 64;
+	gl::texture_dma<uint16_t, 4> texImg{"texImg", w, h, gl::buf_use::duplex()};
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	color = texelFetch(u_img, ivec2(gl_FragCoord.xy), 0);
+}
+)GLSL", getContext());
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	auto fill = [w, h](uint16_t *dst, int f) {
+		for (int i = 0; i < w * h * 4; i++)
+			dst[i] = (uint16_t) ((i + f * 7) & 0xfff);
+	};
+	int frame = 0;
+	auto ref = [w, &frame](int c, int x, int y) { return ((y * w + x) * 4 + c + frame * 7) & 0xfff; };
+
+	// upload() copies right away, the caller's buffer is free to reuse
+	HlBuf<uint16_t> hlImg{4, w, h}, hlOut{4, w, h};
+	fill(hlImg.begin(), 0);
+	texImg.upload(hlImg);
+	fill(hlImg.begin(), 99);
+	renderer.render();
+	renderer.getResult(hlOut);
+	COMP_RGBA(hlOut, ref, 0);
+	LOG_I << texImg.to_string();
+
+	// more frames than buffers, written in place
+	for (frame = 1; frame < 8; frame++) {
+		uint16_t *dst = texImg.lock<texImg.cpu_write>(hlImg.number_of_elements());
+		fill(dst, frame);
+		texImg.unlock();
+		renderer.render();
+		renderer.getResult(hlOut);
+		COMP_RGBA(hlOut, ref, 0);
+	}
+
+	// the newest of several uploads between renders wins
+	for (frame = 20; frame < 24; frame++)
+		fill(hlImg.begin(), frame), texImg.upload(hlImg);
+	frame = 23;
+	renderer.render();
+	renderer.getResult(hlOut);
+	COMP_RGBA(hlOut, ref, 0);
+
+	// uploads through the base class take the ring too, copied right away
+	gl::texture2d<uint16_t, 4> &base(texImg);
+	frame = 30;
+	fill(hlImg.begin(), frame), base.upload(hlImg.begin(), hlImg.number_of_elements());
+	fill(hlImg.begin(), 99);
+	renderer.render();
+	renderer.getResult(hlOut);
+	COMP_RGBA(hlOut, ref, 0);
+
+	std::fill(hlOut.begin(), hlOut.begin() + hlOut.number_of_elements(), 0);
+	texImg.read(hlOut.begin(), hlOut.number_of_elements());
+	COMP_RGBA(hlOut, ref, 0);
+	EXPECT_THROW(texImg.upload(hlImg.begin(), 16), std::runtime_error);
+}
+
+TEST(renderer2d, half_float) {
+	// vector kernels match the scalar code, which rounds to nearest even
+	std::vector<float> v = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 65520.0f, 1e6f, 6e-8f, 3e-5f, 1.0f + 1.0f / 2048,
+							1.0f + 3.0f / 2048, INFINITY, -INFINITY};
+	for (int i = 0; i < 1000; i++)
+		v.push_back((float) (std::rand() % 20001 - 10000) * 0.0137f);
+	std::vector<gl::float16_t> h(v.size());
+	std::vector<float> back(v.size());
+	gl::half::fromFloat(v.data(), h.data(), v.size());
+	gl::half::toFloat(h.data(), back.data(), v.size());
+	for (size_t i = 0; i < v.size(); i++) {
+		ASSERT_EQ(gl::half::fromFloat(v[i]).h, h[i].h) << v[i];
+		ASSERT_EQ(gl::half::toFloat(h[i]), back[i]) << v[i];
+		if (std::fabs(v[i]) <= 65504.0f && std::fabs(v[i]) >= 6.1e-5f)
+			ASSERT_NEAR(v[i], back[i], std::fabs(v[i]) / 2048) << v[i];
+	}
+	EXPECT_EQ(0x3c00, h[2].h);
+	EXPECT_EQ(0x7c00, h[5].h); // above the largest half
+	EXPECT_EQ(0x0001, h[7].h); // smallest subnormal
+	EXPECT_EQ(0x3c00, h[9].h); // tie to even
+	EXPECT_EQ(0x3c02, h[10].h);
+
+	// RGBA16F input, R16F target, converted on upload and readback
+	int w = 64, ht = 16;
+	gl::texture2d<gl::float16_t, 4> texImg{"texImg", w, ht};
+	gl::renderer2d<gl::float16_t, 1> renderer(w, ht, R"GLSL(#version 300 es
+precision highp float;
+uniform highp sampler2D u_img;
+out highp vec4 color;
+void main() {
+	vec4 p = texelFetch(u_img, ivec2(gl_FragCoord.xy), 0);
+	color = vec4(p.r * p.g - p.b + p.a * 0.5);
+}
+)GLSL", getContext());
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<float> hlImg{4, w, ht}, hlOut{1, w, ht};
+	for (int y = 0; y < ht; y++)
+		for (int x = 0; x < w; x++)
+			for (int c = 0; c < 4; c++)
+				hlImg(c, x, y) = (float) (x - 32) * 0.25f + (float) (y * (c + 1)) * 0.125f;
+	texImg.upload(hlImg);
+	renderer.render();
+	renderer.getResult(hlOut);
+
+	auto ref = [&hlImg](int c, int x, int y) {
+		auto q = [](float f) { return gl::half::toFloat(gl::half::fromFloat(f)); };
+		float r = q(hlImg(0, x, y)), g = q(hlImg(1, x, y)), b = q(hlImg(2, x, y)), a = q(hlImg(3, x, y));
+		return r * g - b + a * 0.5f;
+	};
+	for (int y = 0; y < ht; y++)
+		for (int x = 0; x < w; x++)
+			ASSERT_NEAR(ref(0, x, y), hlOut(0, x, y), std::fabs(ref(0, x, y)) / 1024 + 1e-3) << x << "," << y;
+	LOG_I << "half float conversion: " << gl::half::simdName();
+}
+
+#if defined(__linux__)
+TEST(program_cache, startup_cold_warm) {
+	int w = 32, h = 8, nRenderers = 8;
+	char dirTemplate[] = "/tmp/glimp_program_cache_XXXXXX";
+	ASSERT_NE(nullptr, mkdtemp(dirTemplate));
+	std::string dir(dirTemplate);
+	auto &cache(gl::program_cache::get());
+	cache.setBinaryDirectory(dir);
+
+	gl::render_executor executor(getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", w, h};
+	HlBuf<uint16_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+
+	// starts the renderers (one program each) and checks their output, returns the start time
+	auto startAll = [&]() {
+		std::vector<std::unique_ptr<gl::renderer2d<uint16_t, 4>>> renderers;
+		auto t0 = std::chrono::steady_clock::now();
+		for (int r = 0; r < nRenderers; r++) {
+			renderers.emplace_back(new gl::renderer2d<uint16_t, 4>(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	uvec4 v = texelFetch(u_img, ivec2(gl_FragCoord.xy), 0);
+	for (int i = 0; i < 4; ++i) v = (v * 3U + uvec4(i)) % 1024U;
+	color = v + )GLSL" + std::to_string(r) + "U;\n}\n", getContext()));
+			renderers.back()->addInput("u_img", texImg);
+			renderers.back()->setExecutor(executor);
+			renderers.back()->startBackgroundRenderThread();
+		}
+		auto dt = std::chrono::steady_clock::now() - t0;
+
+		HlBuf<uint16_t> hlOut{4, w, h};
+		for (int r = 0; r < nRenderers; r++) {
+			renderers[r]->render();
+			renderers[r]->getResult(hlOut);
+			uint32_t v = hlImg(5, 3, 1);
+			for (uint32_t i = 0; i < 4; ++i) v = (v * 3 + i) % 1024;
+			EXPECT_EQ(v + r, hlOut(5, 3, 1)) << "renderer " << r;
+		}
+		return std::chrono::duration<double, std::milli>(dt).count();
+	};
+
+	auto loaded0 = cache.loadedCount(), compiled0 = cache.compiledCount();
+	double cold = startAll();
+	EXPECT_EQ(compiled0 + nRenderers, cache.compiledCount());
+	EXPECT_EQ(loaded0, cache.loadedCount());
+
+	cache.clear(); // as a new process would
+	double warm = startAll();
+	EXPECT_EQ(compiled0 + nRenderers, cache.compiledCount());
+	EXPECT_EQ(loaded0 + nRenderers, cache.loadedCount());
+	LOG_I << "program_cache: starting " << nRenderers << " renderers took " << cold << " ms cold, "
+		  << warm << " ms warm";
+
+	// binaries the driver rejects are rebuilt from source
+	std::vector<std::string> files;
+	DIR *d = opendir(dir.c_str());
+	ASSERT_NE(nullptr, d);
+	while (dirent *e = readdir(d))
+		if (e->d_name[0] != '.') files.push_back(dir + "/" + e->d_name);
+	closedir(d);
+	EXPECT_EQ((size_t) nRenderers, files.size());
+	for (auto &fn : files) {
+		std::fstream f(fn, std::ios::in | std::ios::out | std::ios::binary);
+		f.seekp(-16, std::ios::end);
+		f.write("corrupted binary", 16);
+	}
+	cache.clear();
+	startAll();
+	EXPECT_EQ(compiled0 + 2 * nRenderers, cache.compiledCount());
+
+	cache.setBinaryDirectory("");
+	for (auto &fn : files)
+		std::remove(fn.c_str());
+	rmdir(dir.c_str());
+}
+#endif
+
+TEST(program_cache, shared_variants) {
+	int w = 32, h = 8;
+	// WIDTH is a macro, MAX_WIDTH must stay intact
+	std::string src = R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+uniform highp uint u_add;
+out highp uvec4 color;
+const highp uint MAX_WIDTH = 1000U;
+void main() {
+	color = texelFetch(u_img, ivec2(gl_FragCoord.xy), 0) + u_add + uint(WIDTH) * MAX_WIDTH;
+}
+)GLSL";
+
+	gl::render_executor executor(getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", w, h};
+	HlBuf<uint16_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+
+	auto &cache(gl::program_cache::get());
+	auto compiled0 = cache.compiledCount(), shared0 = cache.sharedCount();
+
+	// equal sources and sizes give one compile, each renderer keeps its own uniforms
+	std::vector<std::unique_ptr<gl::renderer2d<uint16_t, 4>>> renderers;
+	for (int r = 0; r < 3; r++) {
+		renderers.emplace_back(new gl::renderer2d<uint16_t, 4>(w, h, src, getContext()));
+		renderers.back()->addInput("u_img", texImg);
+		renderers.back()->setExecutor(executor);
+		renderers.back()->startBackgroundRenderThread();
+		renderers.back()->updateUniforms([r](GLuint prog) {
+			glUniform1ui(glGetUniformLocation(prog, "u_add"), r);
+		});
+	}
+	EXPECT_EQ(compiled0 + 1, cache.compiledCount());
+	EXPECT_EQ(shared0 + 2, cache.sharedCount());
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int r = 0; r < 3; r++) {
+		renderers[r]->render();
+		renderers[r]->getResult(hlOut);
+		EXPECT_EQ(hlImg(7, 2, 3) + r + w * 1000, hlOut(7, 2, 3)) << "renderer " << r;
+	}
+
+	// another size is another variant
+	gl::renderer2d<uint16_t, 4> other(w / 2, h, src, getContext());
+	gl::texture2d<uint16_t, 4> texHalf{"texHalf", w / 2, h};
+	other.addInput("u_img", texHalf);
+	other.setExecutor(executor);
+	other.startBackgroundRenderThread();
+	EXPECT_EQ(compiled0 + 2, cache.compiledCount());
+}
+
+TEST(program_cache, warm_up) {
+	int w = 32, h = 8, nPrograms = 15;
+	// a family of filters differing in a constant, as a filter graph would have
+	auto filter = [](const std::string &tag, int i) {
+		return R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	highp uvec4 sum = uvec4(0);
+	for (int dy = -2; dy <= 2; ++dy)
+		for (int dx = -2; dx <= 2; ++dx)
+			sum += texelFetch(u_img, clamp(pos + ivec2(dx, dy), ivec2(0), ivec2(WIDTH - 1, HEIGHT - 1)), 0);
+	color = sum / 25U + )GLSL" + std::to_string(i) + "U; // " + tag + "\n}\n";
+	};
+
+	gl::render_executor executor(getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", w, h};
+	HlBuf<uint16_t> hlImg{4, w, h}, hlOut{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	auto &cache(gl::program_cache::get());
+
+	auto startAll = [&](const std::string &tag) {
+		std::vector<std::unique_ptr<gl::renderer2d<uint16_t, 4>>> renderers;
+		Stopwatch sw;
+		sw.start();
+		for (int i = 0; i < nPrograms; i++) {
+			renderers.emplace_back(new gl::renderer2d<uint16_t, 4>(w, h, filter(tag, i), getContext()));
+			renderers.back()->addInput("u_img", texImg);
+			renderers.back()->setExecutor(executor);
+			renderers.back()->startBackgroundRenderThread();
+		}
+		sw.measure("start " + tag);
+		renderers.back()->render();
+		renderers.back()->getResult(hlOut);
+		LOG_I << sw.getStats();
+		return renderers;
+	};
+
+	auto warmUp = [&](const std::string &tag, int threads, bool broken) {
+		std::vector<std::vector<gl::shader_stage>> programs;
+		for (int i = 0; i < nPrograms; i++)
+			programs.push_back(gl::renderer2d<uint16_t, 4>::programStages(filter(tag, i), w, h));
+		if (broken)
+			programs.push_back(gl::renderer2d<uint16_t, 4>::programStages("syntax error", w, h));
+		int built = -1;
+		gl::render_ticket done(-1u);
+		Stopwatch sw;
+		sw.start();
+		executor.post([&, done]() mutable {
+			built = cache.warmUp(executor.getContext(), programs, threads);
+			done._complete();
+		});
+		done.wait(std::chrono::seconds(20));
+		sw.measure("warm up " + tag);
+		LOG_I << sw.getStats();
+		return built;
+	};
+
+	// cold: renderers compile one after another
+	startAll("cold");
+
+	// warmed up with the driver's parallel compile (or one thread per core)
+	EXPECT_EQ(nPrograms, warmUp("parallel", 0, false));
+	auto compiled = cache.compiledCount();
+	startAll("parallel");
+	EXPECT_EQ(compiled, cache.compiledCount()) << "starting warmed up renderers compiled";
+
+	// worker threads on shared contexts, failures are skipped
+	EXPECT_EQ(nPrograms, warmUp("threads", 4, true));
+	compiled = cache.compiledCount();
+	startAll("threads");
+	EXPECT_EQ(compiled, cache.compiledCount());
+	EXPECT_EQ(0, warmUp("threads", 4, false)) << "programs built twice";
+
+	// the last renderer adds nPrograms - 1 to the box filter
+	uint32_t sum = 0;
+	for (int dy = -2; dy <= 2; ++dy)
+		for (int dx = -2; dx <= 2; ++dx)
+			sum += hlImg(0, std::min(std::max(3 + dx, 0), w - 1), std::min(std::max(4 + dy, 0), h - 1));
+	EXPECT_EQ(sum / 25 + nPrograms - 1, hlOut(0, 3, 4));
+}
+
+TEST(compute2d, shared_memory_box3x3) {
+	int w = 70, h = 20;
+	typedef uint16_t tex_t;
+
+	gl::compute2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 310 es
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
+layout(rgba16ui, binding = 0) writeonly uniform highp uimage2D u_out;
+layout(rgba16ui, binding = 1) readonly uniform highp uimage2D u_img;
+shared uint tile[LOCAL_SIZE_Y + 2][LOCAL_SIZE_X + 2];
+void main() {
+	ivec2 size = ivec2(WIDTH, HEIGHT);
+	ivec2 g = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 l = ivec2(gl_LocalInvocationID.xy);
+	ivec2 base = ivec2(gl_WorkGroupID.xy) * ivec2(LOCAL_SIZE_X, LOCAL_SIZE_Y) - 1;
+	for (int y = l.y; y < LOCAL_SIZE_Y + 2; y += LOCAL_SIZE_Y)
+		for (int x = l.x; x < LOCAL_SIZE_X + 2; x += LOCAL_SIZE_X)
+			tile[y][x] = imageLoad(u_img, clamp(base + ivec2(x, y), ivec2(0), size - 1)).r;
+	barrier();
+	if (g.x >= size.x || g.y >= size.y)
+		return;
+	uint sum = 0U;
+	for (int dy = 0; dy < 3; ++dy)
+		for (int dx = 0; dx < 3; ++dx)
+			sum += tile[l.y + dy][l.x + dx];
+	imageStore(u_out, g, uvec4(sum, uint(g.x), uint(g.y), 0U));
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.setWorkGroupSize(8, 8);
+	renderer.startBackgroundRenderThread();
+	EXPECT_EQ(9, renderer.workGroupsX());
+	EXPECT_EQ(3, renderer.workGroupsY());
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int n = 0; n < 2; n++) {
+		fillRand(hlImg, 1000);
+		texImg.upload(hlImg);
+		renderer.submit(hlOut).wait();
+
+		auto ref = [&hlImg, w, h](int c, int x, int y) {
+			if (c == 1) return x;
+			if (c == 2) return y;
+			if (c == 3) return 0;
+			int sum = 0;
+			for (int dy = -1; dy <= 1; ++dy)
+				for (int dx = -1; dx <= 1; ++dx)
+					sum += hlImg(0, std::min(std::max(x + dx, 0), w - 1), std::min(std::max(y + dy, 0), h - 1));
+			return sum;
+		};
+		COMP_RGBA(hlOut, ref, 0.0001);
+	}
+}
+
+TEST(renderer2d, multi_producer) {
+	int w = 64, h = 16, nThreads = 4, nFrames = 20;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+uniform highp uint u_add;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = u_add + texelFetch(u_img, pos, 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	renderer.updateUniforms([](GLuint prog) {
+		glUniform1ui(glGetUniformLocation(prog, "u_add"), 3);
+	});
+
+	std::vector<std::thread> producers;
+	std::atomic<int> failures(0);
+	for (int t = 0; t < nThreads; t++) {
+		producers.emplace_back([&]() {
+			HlBuf<uint16_t> hlOut{4, w, h};
+			for (int i = 0; i < nFrames; i++) {
+				renderer.submit(hlOut).wait();
+				for (int y = 0; y < h; ++y)
+					for (int x = 0; x < w; ++x)
+						if (hlOut(0, x, y) != 3 + hlImg(0, x, y)) ++failures;
+			}
+		});
+	}
+	for (auto &p : producers) p.join();
+	EXPECT_EQ(0, failures);
+
+	// round trip of a command without GPU work
+	Stopwatch sw;
+	for (int i = 0; i < 200; i++) {
+		sw.start();
+		renderer.updateUniforms([](GLuint) {}).wait();
+		sw.measure("wake");
+	}
+	LOG_I << "multi_producer" << std::endl << sw.getStats();
+}
+
+#if defined(__linux__)
+TEST(renderer2d, completion_fd_epoll) {
+	int w = 32, h = 8, nRenderers = 6, nFrames = 3;
+	typedef uint16_t tex_t;
+
+	gl::render_executor executor(getContext());
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ASSERT_NE(-1, ep);
+
+	std::vector<std::unique_ptr<gl::renderer2d<uint16_t, 4>>> renderers;
+	for (int r = 0; r < nRenderers; r++) {
+		renderers.emplace_back(new gl::renderer2d<uint16_t, 4>(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+uniform highp uint u_add;
+out highp uvec4 color;
+void main() {
+	color = u_add + texelFetch(u_img, ivec2(gl_FragCoord.xy), 0);
+}
+)GLSL", getContext()));
+		auto &renderer(*renderers.back());
+		renderer.addInput("u_img", texImg);
+		renderer.setExecutor(executor);
+		renderer.setMaxFramesInFlight(nFrames);
+		renderer.setReadbackRingSize(nFrames);
+		renderer.startBackgroundRenderThread();
+		renderer.updateUniforms([r](GLuint prog) {
+			glUniform1ui(glGetUniformLocation(prog, "u_add"), r);
+		});
+
+		EXPECT_EQ(0u, renderer.drainCompletions());
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.u32 = r;
+		ASSERT_EQ(0, epoll_ctl(ep, EPOLL_CTL_ADD, renderer.getCompletionFd(), &ev));
+	}
+
+	std::vector<HlBuf<uint16_t>> outs;
+	std::vector<gl::render_ticket> tickets;
+	outs.reserve(nRenderers * nFrames);
+	for (int i = 0; i < nFrames; i++) {
+		for (int r = 0; r < nRenderers; r++) {
+			outs.emplace_back(4, w, h);
+			tickets.push_back(renderers[r]->submit(outs.back()));
+		}
+	}
+
+	// one thread collects all completions without blocking on any renderer
+	uint64_t completed = 0;
+	std::vector<uint64_t> perRenderer(nRenderers, 0);
+	while (completed < (uint64_t) (nRenderers * nFrames)) {
+		epoll_event events[8];
+		int n = epoll_wait(ep, events, 8, 4000);
+		ASSERT_GT(n, 0) << "no completion within 4s";
+		for (int k = 0; k < n; k++) {
+			uint64_t c = renderers[events[k].data.u32]->drainCompletions();
+			perRenderer[events[k].data.u32] += c;
+			completed += c;
+		}
+	}
+	close(ep);
+
+	for (int r = 0; r < nRenderers; r++) {
+		EXPECT_EQ((uint64_t) nFrames, perRenderer[r]);
+		EXPECT_EQ(0u, renderers[r]->drainCompletions());
+	}
+	for (size_t t = 0; t < tickets.size(); t++) {
+		ASSERT_TRUE(tickets[t].poll());
+		int r = t % nRenderers;
+		auto &out(outs[t]);
+		auto ref = [&hlImg, r](int c, int x, int y) { return hlImg(c, x, y) + r; };
+		COMP_RGBA(out, ref, 0.0001);
+	}
+}
+#endif
+
+TEST(renderer2d, streaming_latest_wins) {
+	int w = 32, h = 8, nFrames = 300;
+	typedef uint16_t tex_t;
+
+	gl::renderer2d<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	color = 1U + texelFetch(u_img, ivec2(gl_FragCoord.xy), 0);
+}
+)GLSL", getContext());
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	renderer.addInput("u_img", texImg);
+	renderer.enableStreaming(texImg);
+	renderer.startBackgroundRenderThread();
+
+	HlBuf<uint16_t> hlOut{4, w, h};
+	EXPECT_FALSE(renderer.getLatestResult(hlOut));
+
+	// a bursty producer, each frame filled with its index
+	std::thread producer([&]() {
+		HlBuf<tex_t> hlImg{4, w, h};
+		for (int i = 0; i < nFrames; i++) {
+			std::fill(hlImg.begin(), hlImg.begin() + hlImg.number_of_elements(), (tex_t) i);
+			renderer.publishFrame(hlImg);
+			if (i % 10 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	int last = 0, nResults = 0, failures = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	while (last != nFrames && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(4)) {
+		if (!renderer.getLatestResult(hlOut)) {
+			std::this_thread::yield();
+			continue;
+		}
+		int v = hlOut(0, 0, 0);
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < w; ++x)
+				if (hlOut(0, x, y) != v || hlOut(3, x, y) != v) ++failures; // no torn frames
+		if (v <= last) ++failures; // only ever newer frames
+		last = v, ++nResults;
+	}
+	producer.join();
+
+	EXPECT_EQ(nFrames, last); // the newest frame always arrives
+	EXPECT_EQ(0, failures);
+	EXPECT_EQ((uint64_t) nFrames, renderer.streamedFrames() + renderer.droppedFrames());
+	EXPECT_FALSE(renderer.getLatestResult(hlOut));
+	LOG_I << "streaming: " << renderer.streamedFrames() << " rendered, " << renderer.droppedFrames()
+		  << " dropped, " << nResults << " results taken";
+}
+
+TEST(renderer2d, shared_executor) {
+	int w = 64, h = 16, nFilters = 8;
+	typedef uint16_t tex_t;
+
+	gl::render_executor executor(getContext());
+
+	// a chain of filters, each adding 1 to the output of the previous one
+	const char *shader = R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL";
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	std::vector<std::unique_ptr<gl::renderer2d<uint16_t, 4>>> filters;
+	for (int i = 0; i < nFilters; i++) {
+		filters.emplace_back(new gl::renderer2d<uint16_t, 4>(w, h, shader, getContext()));
+		auto &f(*filters.back());
+		f.setExecutor(executor);
+		f.addInput("u_img", i == 0 ? (gl::texture_base &) texImg : filters[i - 1]->getOutputTexture());
+		f.startBackgroundRenderThread();
+	}
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int n = 0; n < 3; n++) {
+		fillRand(hlImg, 1000);
+		texImg.upload(hlImg);
+		for (auto &f : filters)
+			f->submit();
+		filters.back()->submit(hlOut).wait();
+
+		auto ref = [&hlImg, nFilters](int c, int x, int y) { return nFilters + hlImg(c, x, y); };
+		COMP_RGBA(hlOut, ref, 0.0001);
+	}
+
+	filters.clear();
+}
+
+TEST(pipeline, chain) {
+	int w = 64, h = 16, nPasses = 10;
+	typedef uint16_t tex_t;
+
+	gl::render_executor executor(getContext());
+	gl::pipeline<uint16_t, 4> pipe(w, h, executor);
+
+	const char *shader = R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	color = 1U + texelFetch(u_img, pos, 0);
+}
+)GLSL";
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	gl::pipeline<uint16_t, 4>::node_id prev = -1;
+	for (int i = 0; i < nPasses; i++) {
+		auto id = pipe.addPass("add" + std::to_string(i), shader);
+		if (i == 0) pipe.addInput(id, "u_img", texImg);
+		else pipe.connect(prev, id, "u_img");
+		prev = id;
+	}
+	pipe.start();
+	EXPECT_EQ(2, pipe.intermediateTargetCount());
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	HlBuf<uint16_t> hlOut{4, w, h};
+	for (int n = 0; n < 3; n++) {
+		fillRand(hlImg, 1000);
+		texImg.upload(hlImg);
+		pipe.submit().wait();
+		pipe.getResult(prev, hlOut);
+
+		auto ref = [&hlImg, nPasses](int c, int x, int y) { return nPasses + hlImg(c, x, y); };
+		COMP_RGBA(hlOut, ref, 0.0001);
+	}
+}
+
+TEST(pipeline, diamond) {
+	int w = 64, h = 16;
+	typedef uint16_t tex_t;
+
+	gl::render_executor executor(getContext());
+	gl::pipeline<uint16_t, 4> pipe(w, h, executor);
+
+	auto pass = [](const std::string &expr) {
+		return std::string(R"GLSL(#version 300 es
+uniform highp usampler2D u_a;
+uniform highp usampler2D u_b;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	uvec4 a = texelFetch(u_a, pos, 0);
+	uvec4 b = texelFetch(u_b, pos, 0);
+	color = )GLSL") + expr + ";\n}\n";
+	};
+
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	auto src = pipe.addPass("src", pass("a + 1U"));
+	auto twice = pipe.addPass("twice", pass("2U * a"));
+	auto plus = pipe.addPass("plus", pass("a + 5U"));
+	auto sum = pipe.addPass("sum", pass("a + b"));
+	auto copy = pipe.addPass("copy", pass("a"));
+	pipe.addInput(src, "u_a", texImg);
+	pipe.connect(src, twice, "u_a");
+	pipe.connect(src, plus, "u_a");
+	pipe.connect(twice, sum, "u_a");
+	pipe.connect(plus, sum, "u_b");
+	pipe.connect(src, copy, "u_a"); // second sink
+	pipe.start();
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	pipe.submit().wait();
+
+	HlBuf<uint16_t> hlSum{4, w, h}, hlCopy{4, w, h};
+	pipe.getResult(sum, hlSum);
+	pipe.getResult(copy, hlCopy);
+	EXPECT_THROW(pipe.getResult(twice, hlSum), std::logic_error);
+
+	auto refSum = [&hlImg](int c, int x, int y) { return 3 * (hlImg(c, x, y) + 1) + 5; };
+	COMP_RGBA(hlSum, refSum, 0.0001);
+	auto refCopy = [&hlImg](int c, int x, int y) { return hlImg(c, x, y) + 1; };
+	COMP_RGBA(hlCopy, refCopy, 0.0001);
+}
+
+TEST(pipeline, failures) {
+	int w = 64, h = 16;
+	gl::render_executor executor(getContext());
+	const char *shader = R"GLSL(#version 300 es
+out highp uvec4 color;
+void main() {
+	color = uvec4(1U);
+}
+)GLSL";
+
+	// a pass that does not compile releases what the passes before it got
+	{
+		gl::pipeline<uint16_t, 4> pipe(w, h, executor);
+		auto first = pipe.addPass("first", shader);
+		auto broken = pipe.addPass("broken", "#version 300 es\nsyntax error");
+		pipe.connect(first, broken, "u_img");
+		EXPECT_THROW(pipe.start(), std::runtime_error);
+		EXPECT_EQ(0, pipe.intermediateTargetCount());
+	}
+
+	// destroyed while the executor is blocked, the cleanup is cancelled instead of terminating
+	std::atomic<bool> blocked{true};
+	{
+		gl::pipeline<uint16_t, 4> pipe(w, h, executor);
+		pipe.addPass("pass", shader);
+		pipe.start();
+		pipe.submit().wait();
+		pipe.setResponseTimeout(std::chrono::milliseconds(20));
+		executor.post([&blocked]() {
+			while (blocked) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		});
+	}
+	blocked = false;
+
+	gl::pipeline<uint16_t, 4> pipe(w, h, executor);
+	auto pass = pipe.addPass("pass", shader);
+	pipe.start();
+	pipe.submit().wait();
+	HlBuf<uint16_t> hlOut{4, w, h};
+	pipe.getResult(pass, hlOut);
+	auto ref = [](int c, int x, int y) { return 1; };
+	COMP_RGBA(hlOut, ref, 0);
+}
+
+TEST(stacker, failures) {
+	int w = 32, h = 8;
+	gl::render_executor executor(getContext());
+	gl::texture2d<uint16_t, 4> texImg{"texImg", w, h};
+
+	// a weight function that does not compile releases the programs built before
+	{
+		gl::stacker<float, 4> stack(w, h, texImg, executor);
+		stack.setWeightFunction("float weight(vec4 x, vec4 mean, float wsum, ivec2 pos) { syntax error }");
+		EXPECT_THROW(stack.start(), std::runtime_error);
+	}
+
+	// destroyed while the executor is blocked, the cleanup is cancelled instead of terminating
+	std::atomic<bool> blocked{true};
+	{
+		gl::stacker<float, 4> stack(w, h, texImg, executor);
+		stack.start();
+		stack.setResponseTimeout(std::chrono::milliseconds(20));
+		executor.post([&blocked]() {
+			while (blocked) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		});
+	}
+	blocked = false;
+
+	gl::stacker<float, 4> stack(w, h, texImg, executor);
+	stack.start();
+	HlBuf<uint16_t> hlImg{4, w, h};
+	fillRand(hlImg, 1000);
+	texImg.upload(hlImg);
+	stack.addFrame().wait();
+	HlBuf<float> mean{4, w, h};
+	stack.getMean(mean);
+	auto ref = [&hlImg](int c, int x, int y) { return hlImg(c, x, y); };
+	COMP_RGBA(mean, ref, 0.0001);
+}
+
+TEST(stacker, weighted_mean_variance) {
+	int w = 32, h = 8, nFrames = 6;
+	typedef uint16_t tex_t;
+	const float weights[] = {1, 2, 0.5f, 1, 3, 1};
+
+	gl::render_executor executor(getContext());
+	gl::texture2d<tex_t, 4> texImg{"texImg", w, h};
+	gl::stacker<float, 4> stack(w, h, texImg, executor, true);
+	gl::stacker<uint16_t, 4> stack16(w, h, texImg, executor);
+	stack.start(), stack16.start();
+
+	// large values would overflow u16 additive accumulation after two frames
+	std::vector<HlBuf<tex_t>> frames;
+	for (int i = 0; i < nFrames; i++) {
+		frames.emplace_back(4, w, h);
+		fillRand(frames.back(), 60000);
+		texImg.upload(frames.back());
+		stack.addFrame(weights[i]);
+		stack16.addFrame(weights[i]).wait();
+	}
+	EXPECT_EQ(nFrames, stack.frameCount());
+
+	HlBuf<float> mean{4, w, h}, var{4, w, h};
+	HlBuf<uint16_t> mean16{4, w, h};
+	stack.getMean(mean), stack.getVariance(var), stack16.getMean(mean16);
+
+	int failures = 0;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			for (int c = 0; c < 4; ++c) {
+				double W = 0, m = 0, m2 = 0;
+				for (int i = 0; i < nFrames; i++) W += weights[i], m += weights[i] * frames[i](c, x, y);
+				m /= W;
+				for (int i = 0; i < nFrames; i++) m2 += weights[i] * std::pow(frames[i](c, x, y) - m, 2);
+				if (std::abs(mean(c, x, y) - m) > 0.05) ++failures;
+				if (std::abs(var(c, x, y) - m2 / W) > 1e-4 * m2 / W + 1) ++failures;
+				if (std::abs(mean16(c, x, y) - m) > 0.51) ++failures;
+			}
+		}
+	}
+	EXPECT_EQ(0, failures);
+
+	stack.reset();
+	EXPECT_EQ(0, stack.frameCount());
+	texImg.upload(frames[0]);
+	stack.addFrame(2.0f);
+	stack.getMean(mean), stack.getVariance(var);
+	EXPECT_EQ(float(frames[0](1, 3, 2)), mean(1, 3, 2));
+	EXPECT_EQ(0.0f, var(1, 3, 2));
+	EXPECT_THROW(stack16.getVariance(mean16), std::logic_error);
+}
+
+TEST(tiled_renderer, box3x3) {
+	int w = 300, h = 200;
+	typedef uint16_t tex_t;
+
+	// 3x3 box sum in r, absolute position in g and b
+	gl::tiled_renderer<uint16_t, 4> renderer(w, h, R"GLSL(#version 300 es
+uniform highp usampler2D u_img;
+uniform ivec2 u_tile_origin;
+out highp uvec4 color;
+void main() {
+	ivec2 pos = ivec2(gl_FragCoord.xy);
+	uint sum = 0U;
+	for (int dy = -1; dy <= 1; ++dy)
+		for (int dx = -1; dx <= 1; ++dx)
+			sum += texelFetch(u_img, clamp(pos + ivec2(dx, dy), ivec2(0), ivec2(WIDTH - 1, HEIGHT - 1)), 0).r;
+	ivec2 abs = u_tile_origin + pos;
+	color = uvec4(sum, uint(abs.x), uint(abs.y), 0U);
+}
+)GLSL", "u_img", getContext(), 64, 1);
+	renderer.startBackgroundRenderThread();
+	EXPECT_EQ(5, renderer.tilesX());
+	EXPECT_EQ(4, renderer.tilesY());
+
+	HlBuf<tex_t> hlImg{4, w, h};
+	HlBuf<uint16_t> hlOut{4, w, h};
+	fillRand(hlImg, 1000);
+	renderer.render(hlImg, hlOut);
+
+	auto ref = [&hlImg, w, h](int c, int x, int y) {
+		if (c == 1) return x;
+		if (c == 2) return y;
+		if (c == 3) return 0;
+		int sum = 0;
+		for (int dy = -1; dy <= 1; ++dy)
+			for (int dx = -1; dx <= 1; ++dx)
+				sum += hlImg(0, std::min(std::max(x + dx, 0), w - 1), std::min(std::max(y + dy, 0), h - 1));
+		return sum;
+	};
+	COMP_RGBA(hlOut, ref, 0.0001);
+}
+
 TEST(renderer2d, tex_u32_in_u16) {
 	int w = 320, h = 240;
 	// test multi-byte sampling. we store u32 RGBA data and sample with a u16 RGBA texture